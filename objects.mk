@@ -4,5 +4,41 @@ OBJECTS += obj/src-parser.o
 OBJECT_FILES += $(CURDIR)/obj/src-parser.o
 OBJECTS += obj/src-match.o
 OBJECT_FILES += $(CURDIR)/obj/src-match.o
+OBJECTS += obj/src-input.o
+OBJECT_FILES += $(CURDIR)/obj/src-input.o
+OBJECTS += obj/src-tape.o
+OBJECT_FILES += $(CURDIR)/obj/src-tape.o
+OBJECTS += obj/src-flush.o
+OBJECT_FILES += $(CURDIR)/obj/src-flush.o
+OBJECTS += obj/src-follow.o
+OBJECT_FILES += $(CURDIR)/obj/src-follow.o
+OBJECTS += obj/src-partition.o
+OBJECT_FILES += $(CURDIR)/obj/src-partition.o
+OBJECTS += obj/src-hll.o
+OBJECT_FILES += $(CURDIR)/obj/src-hll.o
+OBJECTS += obj/src-unique.o
+OBJECT_FILES += $(CURDIR)/obj/src-unique.o
+OBJECTS += obj/src-group.o
+OBJECT_FILES += $(CURDIR)/obj/src-group.o
+OBJECTS += obj/src-top.o
+OBJECT_FILES += $(CURDIR)/obj/src-top.o
+OBJECTS += obj/src-idset.o
+OBJECT_FILES += $(CURDIR)/obj/src-idset.o
+OBJECTS += obj/src-framing.o
+OBJECT_FILES += $(CURDIR)/obj/src-framing.o
+OBJECTS += obj/src-encoder.o
+OBJECT_FILES += $(CURDIR)/obj/src-encoder.o
+OBJECTS += obj/src-decoder.o
+OBJECT_FILES += $(CURDIR)/obj/src-decoder.o
+OBJECTS += obj/src-dfa.o
+OBJECT_FILES += $(CURDIR)/obj/src-dfa.o
+OBJECTS += obj/src-validate.o
+OBJECT_FILES += $(CURDIR)/obj/src-validate.o
+OBJECTS += obj/src-profile.o
+OBJECT_FILES += $(CURDIR)/obj/src-profile.o
+OBJECTS += obj/src-hugepage.o
+OBJECT_FILES += $(CURDIR)/obj/src-hugepage.o
+OBJECTS += obj/src-utils.o
+OBJECT_FILES += $(CURDIR)/obj/src-utils.o
 EXCLUSIVE_OBJECTS += obj/src-main.o
 EXCLUSIVE_OBJECT_FILES += $(CURDIR)/obj/src-main.o
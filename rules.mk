@@ -1,8 +1,44 @@
-obj/src-strpool.o: src/strpool.c src/strpool.h src/utils.h
+obj/src-strpool.o: src/strpool.c src/strpool.h src/utils.h src/hugepage.h src/profile.h
 	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-strpool.o $(CURDIR)/src/strpool.c
-obj/src-parser.o: src/parser.c src/parser.h src/match.h src/strpool.h src/utils.h
+obj/src-parser.o: src/parser.c src/parser.h src/decoder.h src/encoder.h src/input.h src/utils.h src/flush.h src/follow.h src/framing.h src/group.h src/strpool.h src/hll.h src/idset.h src/hash.h src/match.h src/partition.h src/sample.h src/tape.h src/top.h src/unique.h src/dfa.h src/profile.h src/simd.h
 	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-parser.o $(CURDIR)/src/parser.c
-obj/src-match.o: src/match.c src/match.h src/utils.h
+obj/src-match.o: src/match.c src/match.h src/dfa.h src/utils.h
 	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-match.o $(CURDIR)/src/match.c
-obj/src-main.o: src/main.c src/parser.h src/match.h src/strpool.h src/utils.h
+obj/src-input.o: src/input.c src/input.h src/utils.h src/hugepage.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-input.o $(CURDIR)/src/input.c
+obj/src-tape.o: src/tape.c src/tape.h src/utils.h src/simd.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-tape.o $(CURDIR)/src/tape.c
+obj/src-flush.o: src/flush.c src/flush.h src/input.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-flush.o $(CURDIR)/src/flush.c
+obj/src-follow.o: src/follow.c src/follow.h src/input.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-follow.o $(CURDIR)/src/follow.c
+obj/src-partition.o: src/partition.c src/partition.h src/match.h src/hash.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-partition.o $(CURDIR)/src/partition.c
+obj/src-hll.o: src/hll.c src/hll.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-hll.o $(CURDIR)/src/hll.c
+obj/src-unique.o: src/unique.c src/unique.h src/strpool.h src/utils.h src/hash.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-unique.o $(CURDIR)/src/unique.c
+obj/src-group.o: src/group.c src/group.h src/strpool.h src/utils.h src/hash.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-group.o $(CURDIR)/src/group.c
+obj/src-top.o: src/top.c src/top.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-top.o $(CURDIR)/src/top.c
+obj/src-idset.o: src/idset.c src/idset.h src/hash.h src/match.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-idset.o $(CURDIR)/src/idset.c
+obj/src-framing.o: src/framing.c src/framing.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-framing.o $(CURDIR)/src/framing.c
+obj/src-encoder.o: src/encoder.c src/encoder.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-encoder.o $(CURDIR)/src/encoder.c
+obj/src-decoder.o: src/decoder.c src/decoder.h src/encoder.h src/input.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-decoder.o $(CURDIR)/src/decoder.c
+obj/src-dfa.o: src/dfa.c src/dfa.h src/hash.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-dfa.o $(CURDIR)/src/dfa.c
+obj/src-validate.o: src/validate.c src/validate.h src/input.h src/utils.h src/simd.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-validate.o $(CURDIR)/src/validate.c
+obj/src-profile.o: src/profile.c src/profile.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-profile.o $(CURDIR)/src/profile.c
+obj/src-hugepage.o: src/hugepage.c src/hugepage.h src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-hugepage.o $(CURDIR)/src/hugepage.c
+obj/src-utils.o: src/utils.c src/utils.h
+	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-utils.o $(CURDIR)/src/utils.c
+obj/src-main.o: src/main.c src/decoder.h src/encoder.h src/input.h src/utils.h src/flush.h src/follow.h src/framing.h src/group.h src/strpool.h src/hll.h src/idset.h src/hash.h src/match.h src/parser.h src/partition.h src/sample.h src/tape.h src/top.h src/unique.h src/profile.h src/validate.h
 	$(CC) $(CFLAGS) -c -o $(CURDIR)/obj/src-main.o $(CURDIR)/src/main.c
@@ -0,0 +1,356 @@
+#include "decoder.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void decoder_init(struct decoder *decoder, enum encoding encoding) {
+  decoder->encoding = encoding;
+  decoder->levels = NULL;
+  decoder->nlevel = 0;
+  decoder->level_capacity = 0;
+  decoder->before.nlevel = 0;
+}
+
+void decoder_destroy(struct decoder *decoder) {
+  free(decoder->levels);
+}
+
+/* Read a big endian integer of `size` bytes. */
+static bool read_be(struct input *input, size_t size, uint64_t *value) {
+  if (unlikely(!input_ensure(input, size)))
+    return false;
+
+  uint64_t v = 0;
+  for (size_t i = 0; i < size; ++i)
+    v = v << 8 | input->curr[i];
+
+  input->curr += size;
+  *value = v;
+  return true;
+}
+
+static double float32_of(uint64_t bits) {
+  uint32_t b = bits;
+  float f;
+  memcpy(&f, &b, sizeof(f));
+  return f;
+}
+
+static double float64_of(uint64_t bits) {
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+/* Widen an IEEE 754 half precision number. */
+static double float16_of(uint64_t bits) {
+  uint32_t sign = (bits & 0x8000) << 16;
+  uint32_t exponent = bits >> 10 & 0x1f;
+  uint32_t mantissa = bits & 0x3ff;
+
+  if (exponent == 0) {
+    /* zero or subnormal, which is normal as a float */
+    if (mantissa == 0)
+      return float32_of(sign);
+    exponent = 127 - 15 + 1;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    mantissa &= 0x3ff;
+  } else if (exponent == 0x1f) {
+    exponent = 0xff;
+  } else {
+    exponent += 127 - 15;
+  }
+
+  return float32_of(sign | exponent << 23 | mantissa << 13);
+}
+
+static void read_msgpack(struct input *input, int b, struct item *item) {
+  uint64_t v = 0;
+  item->indefinite = false;
+
+  if (b < 0x80) {
+    item->type = ITEM_UINT;
+    item->value = b;
+    return;
+  }
+  if (b >= 0xe0) {
+    item->type = ITEM_NEGATIVE;
+    item->value = 0xff - b;
+    return;
+  }
+  if (b < 0x90) {
+    item->type = ITEM_MAP;
+    item->value = b & 0x0f;
+    return;
+  }
+  if (b < 0xa0) {
+    item->type = ITEM_ARRAY;
+    item->value = b & 0x0f;
+    return;
+  }
+  if (b < 0xc0) {
+    item->type = ITEM_STRING;
+    item->value = b & 0x1f;
+    return;
+  }
+
+  item->type = ITEM_INVALID;
+  switch (b) {
+    case 0xc0:
+      item->type = ITEM_NULL;
+      return;
+    case 0xc2:
+      item->type = ITEM_FALSE;
+      return;
+    case 0xc3:
+      item->type = ITEM_TRUE;
+      return;
+    case 0xc4:
+    case 0xc5:
+    case 0xc6:
+      if (read_be(input, 1 << (b - 0xc4), &item->value))
+        item->type = ITEM_BINARY;
+      return;
+    case 0xc7:
+    case 0xc8:
+    case 0xc9:
+      /* length, type and data of an extension */
+      if (read_be(input, 1 << (b - 0xc7), &v) && input_skip(input, v + 1))
+        item->type = ITEM_OTHER;
+      return;
+    case 0xca:
+      if (read_be(input, 4, &v)) {
+        item->type = ITEM_FLOAT;
+        item->number = float32_of(v);
+      }
+      return;
+    case 0xcb:
+      if (read_be(input, 8, &v)) {
+        item->type = ITEM_FLOAT;
+        item->number = float64_of(v);
+      }
+      return;
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+    case 0xcf:
+      if (read_be(input, 1 << (b - 0xcc), &item->value))
+        item->type = ITEM_UINT;
+      return;
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3: {
+      size_t size = 1 << (b - 0xd0);
+      if (!read_be(input, size, &v))
+        return;
+      /* sign extend */
+      unsigned shift = 64 - 8 * size;
+      int64_t value = (int64_t)(v << shift) >> shift;
+      if (value >= 0) {
+        item->type = ITEM_UINT;
+        item->value = value;
+      } else {
+        item->type = ITEM_NEGATIVE;
+        item->value = ~(uint64_t)value;
+      }
+      return;
+    }
+    case 0xd4:
+    case 0xd5:
+    case 0xd6:
+    case 0xd7:
+    case 0xd8:
+      /* type and data of a fixed size extension */
+      if (input_skip(input, 1 + (1 << (b - 0xd4))))
+        item->type = ITEM_OTHER;
+      return;
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+      if (read_be(input, 1 << (b - 0xd9), &item->value))
+        item->type = ITEM_STRING;
+      return;
+    case 0xdc:
+    case 0xdd:
+      if (read_be(input, 2 << (b - 0xdc), &item->value))
+        item->type = ITEM_ARRAY;
+      return;
+    case 0xde:
+    case 0xdf:
+      if (read_be(input, 2 << (b - 0xde), &item->value))
+        item->type = ITEM_MAP;
+      return;
+    default:
+      return;
+  }
+}
+
+static void read_cbor(struct input *input, int b, struct item *item) {
+  static const enum item_type types[] = {
+    ITEM_UINT, ITEM_NEGATIVE, ITEM_BINARY, ITEM_STRING, ITEM_ARRAY, ITEM_MAP,
+  };
+
+  while (true) {
+    unsigned major = b >> 5;
+    unsigned info = b & 0x1f;
+    uint64_t value = info;
+
+    item->type = ITEM_INVALID;
+    item->indefinite = false;
+
+    if (info == 31) {
+      /* indefinite length strings and containers, and break */
+      if (major >= 2 && major <= 5) {
+        item->type = types[major];
+        item->indefinite = true;
+        item->value = 0;
+      } else if (major == 7) {
+        item->type = ITEM_BREAK;
+      }
+      return;
+    }
+    if (info >= 28)
+      return;
+    if (info >= 24 && !read_be(input, 1 << (info - 24), &value))
+      return;
+
+    if (major < 6) {
+      item->type = types[major];
+      item->value = value;
+      return;
+    }
+
+    if (major == 6) {
+      /* a tag only annotates the item following it */
+      b = input_getc(input);
+      if (b == EOF)
+        return;
+      continue;
+    }
+
+    switch (info) {
+      case 20:
+        item->type = ITEM_FALSE;
+        break;
+      case 21:
+        item->type = ITEM_TRUE;
+        break;
+      case 22:
+        item->type = ITEM_NULL;
+        break;
+      case 25:
+        item->type = ITEM_FLOAT;
+        item->number = float16_of(value);
+        break;
+      case 26:
+        item->type = ITEM_FLOAT;
+        item->number = float32_of(value);
+        break;
+      case 27:
+        item->type = ITEM_FLOAT;
+        item->number = float64_of(value);
+        break;
+      default:
+        /* undefined and other simple values */
+        item->type = ITEM_OTHER;
+        break;
+    }
+    return;
+  }
+}
+
+void decoder_read(struct decoder *decoder, struct input *input,
+                  struct item *item) {
+  int b = input_getc(input);
+  if (b == EOF) {
+    item->type = ITEM_EOF;
+    return;
+  }
+
+  input_start_token(input);
+  if (decoder->encoding == ENCODING_MSGPACK) {
+    read_msgpack(input, b, item);
+  } else {
+    read_cbor(input, b, item);
+  }
+}
+
+bool decoder_at_break(struct decoder *decoder, struct input *input) {
+  return decoder->encoding == ENCODING_CBOR && input_fill(input) &&
+         *input->curr == 0xff;
+}
+
+bool decoder_skip(struct decoder *decoder, struct input *input,
+                  uint64_t count, bool indefinite) {
+  struct item item;
+
+  while (indefinite || count != 0) {
+    decoder_read(decoder, input, &item);
+    if (!indefinite)
+      --count;
+
+    switch (item.type) {
+      case ITEM_BREAK:
+        return indefinite;
+      case ITEM_EOF:
+      case ITEM_INVALID:
+        return false;
+      case ITEM_STRING:
+      case ITEM_BINARY:
+        if (item.indefinite) {
+          if (!decoder_skip(decoder, input, 0, true))
+            return false;
+        } else if (!input_skip(input, item.value)) {
+          return false;
+        }
+        break;
+      case ITEM_ARRAY:
+      case ITEM_MAP: {
+        if (item.indefinite) {
+          if (!decoder_skip(decoder, input, 0, true))
+            return false;
+          break;
+        }
+        /* nested items are skipped in the same loop */
+        uint64_t items = item.value << (item.type == ITEM_MAP);
+        if (unlikely(items >> (item.type == ITEM_MAP) != item.value ||
+                     items > UINT64_MAX - count))
+          return false;
+        count += items;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  return true;
+}
+
+void decoder_push(struct decoder *decoder, bool map, const struct item *item) {
+  if (unlikely(decoder->nlevel == decoder->level_capacity)) {
+    size_t capacity = decoder->level_capacity ? 2 * decoder->level_capacity
+                                              : 64;
+    struct decoder_level *levels =
+        realloc(decoder->levels, capacity * sizeof(*levels));
+    if (unlikely(!levels))
+      out_of_memory();
+
+    decoder->levels = levels;
+    decoder->level_capacity = capacity;
+  }
+
+  decoder->levels[decoder->nlevel++] = (struct decoder_level) {
+    .map = map,
+    .indefinite = item->indefinite,
+    .key = map,
+    .state = LEVEL_OPENED,
+    .remaining = map ? 2 * item->value : item->value,
+  };
+}
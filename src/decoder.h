@@ -0,0 +1,114 @@
+#ifndef _DECODER_H
+#define _DECODER_H
+
+#include "encoder.h"
+#include "input.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum item_type: unsigned char {
+  ITEM_UINT,
+  /* the integer -1 - value */
+  ITEM_NEGATIVE,
+  ITEM_FLOAT,
+  ITEM_STRING,
+  ITEM_BINARY,
+  ITEM_ARRAY,
+  ITEM_MAP,
+  ITEM_FALSE,
+  ITEM_TRUE,
+  ITEM_NULL,
+  /* a MessagePack extension or a CBOR simple value, already skipped */
+  ITEM_OTHER,
+  /* end of a CBOR item of indefinite length */
+  ITEM_BREAK,
+  ITEM_EOF,
+  ITEM_INVALID,
+};
+
+/* Head of a MessagePack or CBOR item. Strings and binaries are followed by
+ * `value` bytes, arrays by `value` items and maps by `value` pairs, unless
+ * `indefinite`. */
+struct item {
+  enum item_type type;
+  bool indefinite;
+  uint64_t value;
+  double number;
+};
+
+enum level_state: unsigned char {
+  /* no item read yet, the closing bracket may follow */
+  LEVEL_OPENED,
+  /* an item was read, a ',' or ':' or the closing bracket is due */
+  LEVEL_AFTER_ITEM,
+  /* a ',' or ':' was given out, an item is due */
+  LEVEL_BEFORE_ITEM,
+};
+
+/* An open array or map. */
+struct decoder_level {
+  bool map;
+  bool indefinite;
+  /* in a map, whether the next item is a key */
+  bool key;
+  enum level_state state;
+  /* items left if not `indefinite`, counting keys and values apart */
+  uint64_t remaining;
+};
+
+/* Where the decoder was before reading the head of the current item, so
+ * that the item can be read again. */
+struct decoder_state {
+  size_t nlevel;
+  struct decoder_level top;
+};
+
+/* Reads MessagePack or CBOR input for --input-format, tracking the open
+ * containers so that the parser can present it as JSON tokens. */
+struct decoder {
+  enum encoding encoding;
+  struct decoder_level *levels;
+  size_t nlevel;
+  size_t level_capacity;
+  struct decoder_state before;
+};
+
+void decoder_init(struct decoder *decoder, enum encoding encoding);
+void decoder_destroy(struct decoder *decoder);
+
+/* Read the head of the next item. CBOR tags are skipped. */
+void decoder_read(struct decoder *decoder, struct input *input,
+                  struct item *item);
+
+/* Skip `count` complete items, or items up to a break if `indefinite`,
+ * jumping over the payloads of strings and binaries. Returns false if the
+ * input is invalid or ends first. */
+bool decoder_skip(struct decoder *decoder, struct input *input,
+                  uint64_t count, bool indefinite);
+
+/* Whether a CBOR break is next in the input. */
+bool decoder_at_break(struct decoder *decoder, struct input *input);
+
+void decoder_push(struct decoder *decoder, bool map, const struct item *item);
+
+static inline struct decoder_level *decoder_top(struct decoder *decoder) {
+  return decoder->nlevel ? &decoder->levels[decoder->nlevel - 1] : NULL;
+}
+
+/* Remember the current state before reading the head of an item. */
+static inline void decoder_save(struct decoder *decoder) {
+  decoder->before.nlevel = decoder->nlevel;
+  if (decoder->nlevel)
+    decoder->before.top = decoder->levels[decoder->nlevel - 1];
+}
+
+/* Go back to a state saved with decoder_save(). */
+static inline void decoder_restore(struct decoder *decoder,
+                                   const struct decoder_state *state) {
+  decoder->nlevel = state->nlevel;
+  if (state->nlevel)
+    decoder->levels[state->nlevel - 1] = state->top;
+}
+
+#endif
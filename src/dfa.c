@@ -0,0 +1,547 @@
+#include "dfa.h"
+#include "hash.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+constexpr size_t DFA_MAX_STATES = 4096;
+
+static void *grow(void *array, size_t *capacity, size_t size) {
+  size_t new_capacity = *capacity ? *capacity * 2 : 64;
+  void *new_array = realloc(array, new_capacity * size);
+  if (unlikely(!new_array))
+    out_of_memory();
+
+  *capacity = new_capacity;
+  return new_array;
+}
+
+struct byte_set {
+  uint64_t bits[4];
+};
+
+static inline void set_add(struct byte_set *set, unsigned ch) {
+  set->bits[ch >> 6] |= 1ull << (ch & 63);
+}
+
+static inline bool set_has(const struct byte_set *set, unsigned ch) {
+  return set->bits[ch >> 6] >> (ch & 63) & 1;
+}
+
+static void set_add_range(struct byte_set *set, unsigned lo, unsigned hi) {
+  for (unsigned ch = lo; ch <= hi; ++ch)
+    set_add(set, ch);
+}
+
+static void set_negate(struct byte_set *set) {
+  for (size_t i = 0; i < 4; ++i)
+    set->bits[i] = ~set->bits[i];
+}
+
+static void set_union(struct byte_set *set, const struct byte_set *other) {
+  for (size_t i = 0; i < 4; ++i)
+    set->bits[i] |= other->bits[i];
+}
+
+/* `set` -1 means up to two empty transitions */
+struct nfa_state {
+  int set;
+  int next;
+  int next2;
+};
+
+struct fragment {
+  int start;
+  int end;
+};
+
+struct compiler {
+  const unsigned char *p;
+  const unsigned char *end;
+  const char *error;
+  struct nfa_state *states;
+  size_t nstate;
+  size_t state_capacity;
+  struct byte_set *sets;
+  size_t nset;
+  size_t set_capacity;
+};
+
+static int new_state(struct compiler *c) {
+  if (c->nstate == c->state_capacity)
+    c->states = grow(c->states, &c->state_capacity, sizeof(*c->states));
+
+  c->states[c->nstate] = (struct nfa_state) {
+    .set = -1,
+    .next = -1,
+    .next2 = -1,
+  };
+  return c->nstate++;
+}
+
+static void add_empty(struct compiler *c, int from, int to) {
+  struct nfa_state *state = &c->states[from];
+  if (state->next < 0) {
+    state->next = to;
+  } else {
+    state->next2 = to;
+  }
+}
+
+static struct fragment set_fragment(struct compiler *c,
+                                    const struct byte_set *set) {
+  if (c->nset == c->set_capacity)
+    c->sets = grow(c->sets, &c->set_capacity, sizeof(*c->sets));
+  c->sets[c->nset] = *set;
+
+  int start = new_state(c);
+  int end = new_state(c);
+  c->states[start].set = c->nset++;
+  c->states[start].next = end;
+  return (struct fragment) {start, end};
+}
+
+static struct fragment any_fragment(struct compiler *c) {
+  struct byte_set set;
+  memset(&set, 0xff, sizeof(set));
+  return set_fragment(c, &set);
+}
+
+static struct fragment star(struct compiler *c, struct fragment f) {
+  int start = new_state(c);
+  int end = new_state(c);
+  add_empty(c, start, f.start);
+  add_empty(c, start, end);
+  add_empty(c, f.end, f.start);
+  add_empty(c, f.end, end);
+  return (struct fragment) {start, end};
+}
+
+static struct fragment concat(struct compiler *c, struct fragment f,
+                              struct fragment g) {
+  add_empty(c, f.end, g.start);
+  return (struct fragment) {f.start, g.end};
+}
+
+static int hex_digit(unsigned char ch) {
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  if ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'f')
+    return (ch | 0x20) - 'a' + 10;
+  return -1;
+}
+
+/* -1 for a class escape, whose bytes go to `set` */
+static int parse_escape(struct compiler *c, struct byte_set *set) {
+  if (c->p == c->end) {
+    c->error = "trailing '\\'";
+    return 0;
+  }
+
+  unsigned char ch = *c->p++;
+  struct byte_set class = {};
+  switch (ch) {
+    case 'd':
+    case 'D':
+      set_add_range(&class, '0', '9');
+      break;
+    case 'w':
+    case 'W':
+      set_add_range(&class, '0', '9');
+      set_add_range(&class, 'a', 'z');
+      set_add_range(&class, 'A', 'Z');
+      set_add(&class, '_');
+      break;
+    case 's':
+    case 'S':
+      set_add_range(&class, '\t', '\r');
+      set_add(&class, ' ');
+      break;
+    case 'n':
+      return '\n';
+    case 't':
+      return '\t';
+    case 'r':
+      return '\r';
+    case 'f':
+      return '\f';
+    case 'v':
+      return '\v';
+    case 'x': {
+      int hi = c->end - c->p >= 2 ? hex_digit(c->p[0]) : -1;
+      int lo = hi >= 0 ? hex_digit(c->p[1]) : -1;
+      if (lo < 0) {
+        c->error = "invalid '\\x' escape";
+        return 0;
+      }
+      c->p += 2;
+      return hi << 4 | lo;
+    }
+    default:
+      return ch;
+  }
+
+  /* the upper case forms are the complements */
+  if (ch < 'a')
+    set_negate(&class);
+  set_union(set, &class);
+  return -1;
+}
+
+static struct fragment parse_bracket(struct compiler *c) {
+  struct byte_set set = {};
+  bool negate = c->p != c->end && *c->p == '^';
+  if (negate)
+    ++c->p;
+
+  bool first = true;
+  while (c->p != c->end && (*c->p != ']' || first)) {
+    first = false;
+
+    int lo = *c->p++;
+    if (lo == '\\' && (lo = parse_escape(c, &set)) < 0)
+      continue;
+
+    if (c->end - c->p >= 2 && c->p[0] == '-' && c->p[1] != ']') {
+      c->p += 1;
+      int hi = *c->p++;
+      if (hi == '\\' && (hi = parse_escape(c, &set)) < 0) {
+        c->error = "invalid range in '[]'";
+        break;
+      }
+      if (hi < lo) {
+        c->error = "invalid range in '[]'";
+        break;
+      }
+      set_add_range(&set, lo, hi);
+    } else {
+      set_add(&set, lo);
+    }
+  }
+
+  if (c->p == c->end) {
+    if (!c->error)
+      c->error = "unterminated '['";
+  } else {
+    ++c->p;
+  }
+
+  if (negate)
+    set_negate(&set);
+  return set_fragment(c, &set);
+}
+
+static struct fragment parse_alternation(struct compiler *c);
+
+static struct fragment parse_atom(struct compiler *c) {
+  unsigned char ch = *c->p++;
+  struct byte_set set = {};
+
+  switch (ch) {
+    case '(': {
+      struct fragment f = parse_alternation(c);
+      if (c->p == c->end || *c->p != ')') {
+        if (!c->error)
+          c->error = "unclosed '('";
+        return f;
+      }
+      ++c->p;
+      return f;
+    }
+    case '[':
+      return parse_bracket(c);
+    case '.':
+      return any_fragment(c);
+    case '*':
+    case '+':
+    case '?':
+      c->error = "nothing to repeat";
+      return any_fragment(c);
+    case '^':
+    case '$':
+      c->error = "anchors are only supported at the ends of the pattern";
+      return any_fragment(c);
+    case '\\': {
+      int literal = parse_escape(c, &set);
+      if (literal >= 0)
+        set_add(&set, literal);
+      return set_fragment(c, &set);
+    }
+    default:
+      set_add(&set, ch);
+      return set_fragment(c, &set);
+  }
+}
+
+static struct fragment parse_repetition(struct compiler *c) {
+  struct fragment f = parse_atom(c);
+
+  while (c->p != c->end && !c->error) {
+    unsigned char op = *c->p;
+    if (op == '*') {
+      f = star(c, f);
+    } else if (op == '+') {
+      int end = new_state(c);
+      add_empty(c, f.end, f.start);
+      add_empty(c, f.end, end);
+      f.end = end;
+    } else if (op == '?') {
+      int start = new_state(c);
+      int end = new_state(c);
+      add_empty(c, start, f.start);
+      add_empty(c, start, end);
+      add_empty(c, f.end, end);
+      f = (struct fragment) {start, end};
+    } else {
+      break;
+    }
+    ++c->p;
+  }
+
+  return f;
+}
+
+static struct fragment parse_concatenation(struct compiler *c) {
+  int empty = new_state(c);
+  struct fragment f = {empty, empty};
+
+  while (c->p != c->end && *c->p != '|' && *c->p != ')' && !c->error)
+    f = concat(c, f, parse_repetition(c));
+
+  return f;
+}
+
+static struct fragment parse_alternation(struct compiler *c) {
+  struct fragment f = parse_concatenation(c);
+
+  while (c->p != c->end && *c->p == '|' && !c->error) {
+    ++c->p;
+    struct fragment g = parse_concatenation(c);
+    int start = new_state(c);
+    int end = new_state(c);
+    add_empty(c, start, f.start);
+    add_empty(c, start, g.start);
+    add_empty(c, f.end, end);
+    add_empty(c, g.end, end);
+    f = (struct fragment) {start, end};
+  }
+
+  return f;
+}
+
+static size_t byte_classes(struct compiler *c, unsigned char classes[256]) {
+  size_t nclass = 1;
+  memset(classes, 0, 256);
+
+  for (size_t i = 0; i < c->nset; ++i) {
+    /* refine every class into its members in and out of the set */
+    short refined[256][2];
+    memset(refined, 0xff, sizeof(refined));
+    size_t n = 0;
+    for (unsigned ch = 0; ch < 256; ++ch) {
+      short *class = &refined[classes[ch]][set_has(&c->sets[i], ch)];
+      if (*class < 0)
+        *class = n++;
+      classes[ch] = *class;
+    }
+    nclass = n;
+  }
+
+  return nclass;
+}
+
+struct subset_builder {
+  size_t words;
+  /* state sets of the DFA states, `words` words each */
+  uint64_t *subsets;
+  size_t capacity;
+  /* open addressing table of DFA states by subset, entries are state + 1 */
+  uint32_t *table;
+  size_t table_size;
+  int *stack;
+};
+
+static void closure(struct compiler *c, struct subset_builder *b,
+                    uint64_t *subset) {
+  size_t nstack = 0;
+  for (size_t i = 0; i < c->nstate; ++i) {
+    if (subset[i >> 6] >> (i & 63) & 1)
+      b->stack[nstack++] = i;
+  }
+
+  while (nstack) {
+    struct nfa_state *state = &c->states[b->stack[--nstack]];
+    if (state->set >= 0)
+      continue;
+
+    int next[2] = {state->next, state->next2};
+    for (size_t j = 0; j < 2; ++j) {
+      int k = next[j];
+      if (k >= 0 && !(subset[k >> 6] >> (k & 63) & 1)) {
+        subset[k >> 6] |= 1ull << (k & 63);
+        b->stack[nstack++] = k;
+      }
+    }
+  }
+}
+
+/* -1 if there would be too many states */
+static int find_state(struct subset_builder *b, const uint64_t *subset,
+                      size_t *nstate) {
+  size_t bytes = b->words * sizeof(uint64_t);
+  size_t mask = b->table_size - 1;
+  size_t i = hash_bytes((const unsigned char *)subset, bytes) & mask;
+
+  for (; b->table[i]; i = (i + 1) & mask) {
+    uint32_t state = b->table[i] - 1;
+    if (memcmp(b->subsets + state * b->words, subset, bytes) == 0)
+      return state;
+  }
+
+  if (*nstate == DFA_MAX_STATES)
+    return -1;
+
+  if (*nstate == b->capacity) {
+    size_t capacity = b->capacity;
+    b->subsets = grow(b->subsets, &capacity, bytes);
+    b->capacity = capacity;
+  }
+
+  memcpy(b->subsets + *nstate * b->words, subset, bytes);
+  b->table[i] = ++*nstate;
+  return *nstate - 1;
+}
+
+static struct dfa *build_dfa(struct compiler *c, struct fragment f,
+                             const char **error) {
+  struct dfa *dfa = malloc(sizeof(*dfa));
+  if (unlikely(!dfa))
+    out_of_memory();
+  dfa->nclass = byte_classes(c, dfa->classes);
+
+  unsigned char representatives[256];
+  for (unsigned ch = 256; ch-- > 0;)
+    representatives[dfa->classes[ch]] = ch;
+
+  struct subset_builder b = {
+    .words = (c->nstate + 63) / 64,
+    .subsets = NULL,
+    .capacity = 0,
+    .table_size = 2 * DFA_MAX_STATES,
+  };
+  b.table = calloc(b.table_size, sizeof(*b.table));
+  b.stack = malloc(c->nstate * sizeof(*b.stack));
+  uint64_t *subset = malloc(b.words * sizeof(*subset));
+  if (unlikely(!b.table || !b.stack || !subset))
+    out_of_memory();
+
+  /* the dead state is the empty set */
+  size_t nstate = 0;
+  memset(subset, 0, b.words * sizeof(*subset));
+  find_state(&b, subset, &nstate);
+
+  subset[f.start >> 6] |= 1ull << (f.start & 63);
+  closure(c, &b, subset);
+  dfa->start = find_state(&b, subset, &nstate);
+
+  dfa->table = NULL;
+  size_t table_capacity = 0;
+  for (size_t state = 0; state < nstate; ++state) {
+    while (table_capacity < nstate * dfa->nclass)
+      dfa->table = grow(dfa->table, &table_capacity, sizeof(*dfa->table));
+
+    for (size_t k = 0; k < dfa->nclass; ++k) {
+      unsigned ch = representatives[k];
+      const uint64_t *from = b.subsets + state * b.words;
+
+      memset(subset, 0, b.words * sizeof(*subset));
+      for (size_t i = 0; i < c->nstate; ++i) {
+        struct nfa_state *s = &c->states[i];
+        if ((from[i >> 6] >> (i & 63) & 1) && s->set >= 0 &&
+            set_has(&c->sets[s->set], ch))
+          subset[s->next >> 6] |= 1ull << (s->next & 63);
+      }
+      closure(c, &b, subset);
+
+      int next = find_state(&b, subset, &nstate);
+      if (next < 0) {
+        *error = "pattern too complex";
+        free(dfa->table);
+        free(dfa);
+        dfa = NULL;
+        goto out;
+      }
+      dfa->table[state * dfa->nclass + k] = next;
+    }
+  }
+
+  dfa->nstate = nstate;
+  dfa->accepting = malloc(nstate * sizeof(*dfa->accepting));
+  if (unlikely(!dfa->accepting))
+    out_of_memory();
+  for (size_t state = 0; state < nstate; ++state) {
+    const uint64_t *s = b.subsets + state * b.words;
+    dfa->accepting[state] = s[f.end >> 6] >> (f.end & 63) & 1;
+  }
+
+out:
+  free(b.subsets);
+  free(b.table);
+  free(b.stack);
+  free(subset);
+  return dfa;
+}
+
+struct dfa *dfa_compile(const unsigned char *pattern, size_t length,
+                        const char **error) {
+  struct compiler c = {
+    .p = pattern,
+    .end = pattern + length,
+    .error = NULL,
+  };
+
+  bool anchored_start = length != 0 && pattern[0] == '^';
+  if (anchored_start)
+    ++c.p;
+
+  /* a '$' ends the pattern unless it is escaped */
+  bool anchored_end = false;
+  if (c.end != c.p && c.end[-1] == '$') {
+    size_t backslashes = 0;
+    while (c.end - 1 - backslashes != c.p && c.end[-2 - backslashes] == '\\')
+      ++backslashes;
+    anchored_end = backslashes % 2 == 0;
+  }
+  if (anchored_end)
+    --c.end;
+
+  struct fragment f = parse_alternation(&c);
+  if (!c.error && c.p != c.end)
+    c.error = "unmatched ')'";
+
+  struct dfa *dfa = NULL;
+  if (c.error) {
+    *error = c.error;
+  } else {
+    if (!anchored_start)
+      f = concat(&c, star(&c, any_fragment(&c)), f);
+    if (!anchored_end)
+      f = concat(&c, f, star(&c, any_fragment(&c)));
+    dfa = build_dfa(&c, f, error);
+  }
+
+  free(c.states);
+  free(c.sets);
+  return dfa;
+}
+
+void dfa_delete(struct dfa *dfa) {
+  if (!dfa)
+    return;
+
+  free(dfa->table);
+  free(dfa->accepting);
+  free(dfa);
+}
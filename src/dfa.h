@@ -0,0 +1,37 @@
+#ifndef _DFA_H
+#define _DFA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr uint16_t DFA_DEAD = 0;
+
+/* state 0 is the dead state */
+struct dfa {
+  unsigned char classes[256];
+  size_t nclass;
+  size_t nstate;
+  uint16_t start;
+  /* nstate rows of nclass next states */
+  uint16_t *table;
+  bool *accepting;
+};
+
+/* NULL with `error` set if invalid or too complex */
+struct dfa *dfa_compile(const unsigned char *pattern, size_t length,
+                        const char **error);
+void dfa_delete(struct dfa *dfa);
+
+static inline bool dfa_matches(const struct dfa *dfa, const unsigned char *s,
+                               size_t length) {
+  unsigned state = dfa->start;
+  for (size_t i = 0; i < length; ++i) {
+    state = dfa->table[state * dfa->nclass + dfa->classes[s[i]]];
+    if (state == DFA_DEAD)
+      return false;
+  }
+
+  return dfa->accepting[state];
+}
+
+#endif
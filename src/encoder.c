@@ -0,0 +1,273 @@
+#include "encoder.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void encoder_init(struct encoder *encoder, enum encoding encoding) {
+  encoder->encoding = encoding;
+  encoder->buf = NULL;
+  encoder->length = 0;
+  encoder->capacity = 0;
+  encoder->headers = NULL;
+  encoder->counts = NULL;
+  encoder->nopen = 0;
+  encoder->open_capacity = 0;
+}
+
+void encoder_destroy(struct encoder *encoder) {
+  free(encoder->buf);
+  free(encoder->headers);
+  free(encoder->counts);
+}
+
+static unsigned char *reserve(struct encoder *encoder, size_t size) {
+  if (unlikely(encoder->length + size > encoder->capacity)) {
+    size_t capacity = encoder->capacity ? encoder->capacity : 256;
+    while (capacity < encoder->length + size)
+      capacity *= 2;
+
+    unsigned char *buf = realloc(encoder->buf, capacity);
+    if (unlikely(!buf))
+      out_of_memory();
+
+    encoder->buf = buf;
+    encoder->capacity = capacity;
+  }
+
+  unsigned char *p = encoder->buf + encoder->length;
+  encoder->length += size;
+  return p;
+}
+
+static void put_byte(struct encoder *encoder, unsigned char byte) {
+  *reserve(encoder, 1) = byte;
+}
+
+static void put_be(struct encoder *encoder, uint64_t value, size_t size) {
+  unsigned char *p = reserve(encoder, size);
+  for (size_t i = 0; i < size; ++i)
+    p[i] = value >> (8 * (size - 1 - i));
+}
+
+static void item(struct encoder *encoder) {
+  if (encoder->nopen != 0)
+    ++encoder->counts[encoder->nopen - 1];
+}
+
+static void cbor_head(struct encoder *encoder, unsigned char major,
+                      uint64_t value) {
+  major <<= 5;
+  if (value < 24) {
+    put_byte(encoder, major | value);
+  } else if (value <= UINT8_MAX) {
+    put_byte(encoder, major | 24);
+    put_be(encoder, value, 1);
+  } else if (value <= UINT16_MAX) {
+    put_byte(encoder, major | 25);
+    put_be(encoder, value, 2);
+  } else if (value <= UINT32_MAX) {
+    put_byte(encoder, major | 26);
+    put_be(encoder, value, 4);
+  } else {
+    put_byte(encoder, major | 27);
+    put_be(encoder, value, 8);
+  }
+}
+
+void encoder_null(struct encoder *encoder) {
+  item(encoder);
+  put_byte(encoder, encoder->encoding == ENCODING_MSGPACK ? 0xc0 : 0xf6);
+}
+
+void encoder_bool(struct encoder *encoder, bool value) {
+  item(encoder);
+  if (encoder->encoding == ENCODING_MSGPACK) {
+    put_byte(encoder, value ? 0xc3 : 0xc2);
+  } else {
+    put_byte(encoder, value ? 0xf5 : 0xf4);
+  }
+}
+
+static void put_uint(struct encoder *encoder, uint64_t value) {
+  if (encoder->encoding == ENCODING_CBOR) {
+    cbor_head(encoder, 0, value);
+  } else if (value < 128) {
+    put_byte(encoder, value);
+  } else if (value <= UINT8_MAX) {
+    put_byte(encoder, 0xcc);
+    put_be(encoder, value, 1);
+  } else if (value <= UINT16_MAX) {
+    put_byte(encoder, 0xcd);
+    put_be(encoder, value, 2);
+  } else if (value <= UINT32_MAX) {
+    put_byte(encoder, 0xce);
+    put_be(encoder, value, 4);
+  } else {
+    put_byte(encoder, 0xcf);
+    put_be(encoder, value, 8);
+  }
+}
+
+static void put_negative(struct encoder *encoder, uint64_t magnitude) {
+  if (encoder->encoding == ENCODING_CBOR) {
+    cbor_head(encoder, 1, magnitude);
+    return;
+  }
+
+  int64_t value = -1 - (int64_t)magnitude;
+  if (value >= -32) {
+    put_byte(encoder, (unsigned char)value);
+  } else if (value >= INT8_MIN) {
+    put_byte(encoder, 0xd0);
+    put_be(encoder, (uint64_t)value, 1);
+  } else if (value >= INT16_MIN) {
+    put_byte(encoder, 0xd1);
+    put_be(encoder, (uint64_t)value, 2);
+  } else if (value >= INT32_MIN) {
+    put_byte(encoder, 0xd2);
+    put_be(encoder, (uint64_t)value, 4);
+  } else {
+    put_byte(encoder, 0xd3);
+    put_be(encoder, (uint64_t)value, 8);
+  }
+}
+
+static void put_double(struct encoder *encoder, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  put_byte(encoder, encoder->encoding == ENCODING_MSGPACK ? 0xcb : 0xfb);
+  put_be(encoder, bits, 8);
+}
+
+void encoder_number(struct encoder *encoder, const unsigned char *literal,
+                    size_t length) {
+  item(encoder);
+
+  char text[64];
+  bool negative = length != 0 && literal[0] == '-';
+  bool integer = length < sizeof(text);
+  for (size_t i = negative; i < length && integer; ++i)
+    integer = literal[i] >= '0' && literal[i] <= '9';
+
+  if (integer) {
+    memcpy(text, literal + negative, length - negative);
+    text[length - negative] = '\0';
+
+    errno = 0;
+    unsigned long long magnitude = strtoull(text, NULL, 10);
+    if (errno == 0 && (!negative || magnitude == 0)) {
+      put_uint(encoder, magnitude);
+      return;
+    }
+    /* MessagePack cannot go below INT64_MIN */
+    if (errno == 0 && (encoder->encoding == ENCODING_CBOR ||
+                       magnitude - 1 <= (uint64_t)INT64_MAX)) {
+      put_negative(encoder, magnitude - 1);
+      return;
+    }
+  }
+
+  /* not an integer, or one out of range */
+  char *number = length < sizeof(text) ? text : malloc(length + 1);
+  if (unlikely(!number))
+    out_of_memory();
+  memcpy(number, literal, length);
+  number[length] = '\0';
+  put_double(encoder, strtod(number, NULL));
+  if (number != text)
+    free(number);
+}
+
+void encoder_string(struct encoder *encoder, const unsigned char *s,
+                    size_t length) {
+  item(encoder);
+
+  if (encoder->encoding == ENCODING_CBOR) {
+    cbor_head(encoder, 3, length);
+  } else if (length < 32) {
+    put_byte(encoder, 0xa0 | length);
+  } else if (length <= UINT8_MAX) {
+    put_byte(encoder, 0xd9);
+    put_be(encoder, length, 1);
+  } else if (length <= UINT16_MAX) {
+    put_byte(encoder, 0xda);
+    put_be(encoder, length, 2);
+  } else {
+    if (unlikely(length > UINT32_MAX)) {
+      fputs("string too long for MessagePack", stderr);
+      exit(1);
+    }
+    put_byte(encoder, 0xdb);
+    put_be(encoder, length, 4);
+  }
+
+  memcpy(reserve(encoder, length), s, length);
+}
+
+static void begin_container(struct encoder *encoder, unsigned char msgpack,
+                            unsigned char cbor) {
+  item(encoder);
+
+  if (unlikely(encoder->nopen == encoder->open_capacity)) {
+    size_t capacity = encoder->open_capacity ? 2 * encoder->open_capacity : 16;
+    size_t *headers = realloc(encoder->headers, capacity * sizeof(*headers));
+    size_t *counts = realloc(encoder->counts, capacity * sizeof(*counts));
+    if (unlikely(!headers || !counts))
+      out_of_memory();
+
+    encoder->headers = headers;
+    encoder->counts = counts;
+    encoder->open_capacity = capacity;
+  }
+
+  encoder->headers[encoder->nopen] = encoder->length;
+  encoder->counts[encoder->nopen] = 0;
+  ++encoder->nopen;
+
+  if (encoder->encoding == ENCODING_MSGPACK) {
+    /* the count is patched in by encoder_end() */
+    put_byte(encoder, msgpack);
+    put_be(encoder, 0, 4);
+  } else {
+    put_byte(encoder, cbor);
+  }
+}
+
+void encoder_begin_array(struct encoder *encoder) {
+  begin_container(encoder, 0xdd, 0x9f);
+}
+
+void encoder_begin_map(struct encoder *encoder) {
+  begin_container(encoder, 0xdf, 0xbf);
+}
+
+void encoder_end(struct encoder *encoder) {
+  size_t header = encoder->headers[--encoder->nopen];
+  size_t count = encoder->counts[encoder->nopen];
+
+  if (encoder->encoding == ENCODING_CBOR) {
+    put_byte(encoder, 0xff);
+    return;
+  }
+
+  /* a map counts its keys and values separately */
+  if (encoder->buf[header] == 0xdf)
+    count /= 2;
+
+  if (unlikely(count > UINT32_MAX)) {
+    fputs("container too large for MessagePack", stderr);
+    exit(1);
+  }
+
+  unsigned char *p = encoder->buf + header + 1;
+  for (size_t i = 0; i < 4; ++i)
+    p[i] = count >> (8 * (3 - i));
+}
+
+void encoder_flush(struct encoder *encoder, FILE *out) {
+  fwrite(encoder->buf, 1, encoder->length, out);
+  encoder->length = 0;
+}
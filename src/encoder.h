@@ -0,0 +1,41 @@
+#ifndef _ENCODER_H
+#define _ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum encoding: unsigned char {
+  ENCODING_MSGPACK,
+  ENCODING_CBOR,
+};
+
+/* --output-format encoder, one value at a time */
+struct encoder {
+  enum encoding encoding;
+  unsigned char *buf;
+  size_t length;
+  size_t capacity;
+  /* open containers: offset of their header and number of items so far */
+  size_t *headers;
+  size_t *counts;
+  size_t nopen;
+  size_t open_capacity;
+};
+
+void encoder_init(struct encoder *encoder, enum encoding encoding);
+void encoder_destroy(struct encoder *encoder);
+
+void encoder_null(struct encoder *encoder);
+void encoder_bool(struct encoder *encoder, bool value);
+void encoder_number(struct encoder *encoder, const unsigned char *literal,
+                    size_t length);
+void encoder_string(struct encoder *encoder, const unsigned char *s,
+                    size_t length);
+void encoder_begin_array(struct encoder *encoder);
+void encoder_begin_map(struct encoder *encoder);
+void encoder_end(struct encoder *encoder);
+
+void encoder_flush(struct encoder *encoder, FILE *out);
+
+#endif
@@ -0,0 +1,65 @@
+#include "flush.h"
+#include "input.h"
+#include "utils.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+void flush_policy_init(struct flush_policy *policy, size_t buffer_size,
+                       unsigned long delay_ms) {
+  if (setvbuf(stdout, NULL, _IOFBF, buffer_size) != 0)
+    out_of_memory();
+
+  policy->delay_ms = delay_ms;
+  policy->pending = false;
+}
+
+static bool deadline_passed(struct flush_policy *policy,
+                            const struct timespec *now) {
+  long long elapsed_ms =
+      (long long)(now->tv_sec - policy->first_pending.tv_sec) * 1000 +
+      (now->tv_nsec - policy->first_pending.tv_nsec) / 1000000;
+  return elapsed_ms >= (long long)policy->delay_ms;
+}
+
+static void flush(struct flush_policy *policy) {
+  fflush(stdout);
+  policy->pending = false;
+}
+
+void flush_policy_wrote(struct flush_policy *policy) {
+  if (policy->delay_ms == 0) {
+    fflush(stdout);
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if (!policy->pending) {
+    policy->pending = true;
+    policy->first_pending = now;
+  } else if (deadline_passed(policy, &now)) {
+    flush(policy);
+  }
+}
+
+void flush_policy_before_read(struct input *input, void *data) {
+  struct flush_policy *policy = data;
+  if (!policy->pending)
+    return;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (deadline_passed(policy, &now)) {
+    flush(policy);
+    return;
+  }
+
+  /* nothing to read right now, so don't keep matches waiting */
+  struct pollfd pollfd = { .fd = input->fd, .events = POLLIN };
+  if (poll(&pollfd, 1, 0) == 0)
+    flush(policy);
+}
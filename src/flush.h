@@ -0,0 +1,27 @@
+#ifndef _FLUSH_H
+#define _FLUSH_H
+
+#include "input.h"
+
+#include <stddef.h>
+#include <time.h>
+
+/* Flush policy for -f. stdout is fully buffered and flushed when the buffer
+ * fills up, when `delay_ms` passed since the first unflushed match, or when
+ * reading more input would block. */
+struct flush_policy {
+  unsigned long delay_ms;
+  struct timespec first_pending;
+  bool pending;
+};
+
+void flush_policy_init(struct flush_policy *policy, size_t buffer_size,
+                       unsigned long delay_ms);
+
+/* Called after every match written to stdout. */
+void flush_policy_wrote(struct flush_policy *policy);
+
+/* Input hook called before every read, `data` is the policy. */
+void flush_policy_before_read(struct input *input, void *data);
+
+#endif
@@ -0,0 +1,295 @@
+#include "follow.h"
+#include "input.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+/* how often the checkpoint is saved while busy */
+constexpr long CHECKPOINT_INTERVAL_MS = 1000;
+/* how often the file is checked for rotation while idle, and for growth
+ * when inotify is not available */
+constexpr int POLL_INTERVAL_MS = 250;
+
+static volatile sig_atomic_t stop_requested;
+
+static void request_stop(int sig) {
+  (void)sig;
+  stop_requested = 1;
+}
+
+[[noreturn]] static void follow_error(const char *what, const char *path) {
+  fprintf(stderr, "%s %s: %s\n", what, path, strerror(errno));
+  exit(1);
+}
+
+static long elapsed_ms(const struct timespec *since,
+                       const struct timespec *now) {
+  return (now->tv_sec - since->tv_sec) * 1000 +
+         (now->tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void watch(struct follow *follow) {
+#if defined(__linux__)
+  if (follow->watch_fd >= 0)
+    close(follow->watch_fd);
+
+  follow->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (follow->watch_fd < 0)
+    return;
+
+  uint32_t events = IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+  if (inotify_add_watch(follow->watch_fd, follow->path, events) < 0) {
+    close(follow->watch_fd);
+    follow->watch_fd = -1;
+  }
+#else
+  (void)follow;
+#endif
+}
+
+/* Open the file currently at the followed path. Returns the descriptor, or
+ * -1 on failure. */
+static int open_file(struct follow *follow) {
+  int fd = open(follow->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  follow->dev = st.st_dev;
+  follow->ino = st.st_ino;
+  watch(follow);
+  input_advise_sequential(fd);
+  return fd;
+}
+
+/* Offset saved for the file being followed, or 0 if there is none or it
+ * refers to another file. */
+static size_t load_checkpoint(struct follow *follow, int fd) {
+  FILE *file = fopen(follow->checkpoint_path, "r");
+  if (!file) {
+    if (errno == ENOENT)
+      return 0;
+    follow_error("cannot open", follow->checkpoint_path);
+  }
+
+  uintmax_t dev, ino, offset;
+  bool valid = fscanf(file, "%ju %ju %ju", &dev, &ino, &offset) == 3;
+  fclose(file);
+
+  if (!valid) {
+    fprintf(stderr, "ignoring invalid checkpoint %s\n",
+            follow->checkpoint_path);
+    return 0;
+  }
+
+  /* rotated since the checkpoint was saved */
+  if (dev != (uintmax_t)follow->dev || ino != (uintmax_t)follow->ino)
+    return 0;
+
+  /* truncated since the checkpoint was saved */
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (uintmax_t)st.st_size < offset)
+    return 0;
+
+  return offset;
+}
+
+static void save_checkpoint(struct follow *follow) {
+  if (!follow->checkpoint_path || !follow->dirty)
+    return;
+
+  /* the last processed value was in a file that has been rotated away */
+  if (follow->processed < follow->file_start)
+    return;
+
+  /* matches before the checkpoint must not be lost on a restart */
+  fflush(stdout);
+
+  FILE *file = fopen(follow->checkpoint_tmp, "w");
+  if (!file)
+    follow_error("cannot write", follow->checkpoint_tmp);
+
+  fprintf(file, "%ju %ju %zu\n", (uintmax_t)follow->dev,
+          (uintmax_t)follow->ino, follow->processed - follow->file_start);
+
+  if (fflush(file) != 0 || fsync(fileno(file)) != 0)
+    follow_error("cannot write", follow->checkpoint_tmp);
+  fclose(file);
+
+  if (rename(follow->checkpoint_tmp, follow->checkpoint_path) != 0)
+    follow_error("cannot write", follow->checkpoint_path);
+
+  follow->dirty = false;
+  clock_gettime(CLOCK_MONOTONIC, &follow->last_saved);
+}
+
+static void wait_for_change(struct follow *follow) {
+  if (follow->watch_fd >= 0) {
+    struct pollfd pollfd = { .fd = follow->watch_fd, .events = POLLIN };
+    if (poll(&pollfd, 1, POLL_INTERVAL_MS) > 0) {
+      char events[4096];
+      while (read(follow->watch_fd, events, sizeof(events)) > 0)
+        continue;
+    }
+  } else {
+    struct timespec interval = {
+      .tv_sec = 0,
+      .tv_nsec = POLL_INTERVAL_MS * 1000000L,
+    };
+    nanosleep(&interval, NULL);
+  }
+}
+
+/* Wait until the file grows, is truncated or is replaced by a new file.
+ * Returns false once the process was asked to stop. */
+static bool wait_for_change_or_stop(struct follow *follow,
+                                    struct input *input) {
+  /* idle, so don't keep matches or progress waiting */
+  fflush(stdout);
+  save_checkpoint(follow);
+
+  while (!stop_requested) {
+    struct stat st;
+    size_t file_offset = input_read_offset(input) - follow->file_start;
+
+    if (fstat(input->fd, &st) == 0) {
+      if ((size_t)st.st_size > file_offset)
+        return true;
+
+      if ((size_t)st.st_size < file_offset) {
+        /* truncated in place, read it again from the start */
+        if (lseek(input->fd, 0, SEEK_SET) < 0)
+          follow_error("cannot seek", follow->path);
+        follow->file_start = input_read_offset(input);
+        return true;
+      }
+    }
+
+    if (stat(follow->path, &st) == 0 &&
+        (st.st_dev != follow->dev || st.st_ino != follow->ino)) {
+      /* rotated, and the old file has been read to its end */
+      int fd = open_file(follow);
+      if (fd >= 0) {
+        close(input->fd);
+        input->fd = fd;
+        follow->file_start = input_read_offset(input);
+        return true;
+      }
+    }
+
+    wait_for_change(follow);
+  }
+
+  return false;
+}
+
+/* Input hook at the end of the file. In the middle of a value, wait for the
+ * rest of it. */
+static bool wait_for_data(struct input *input, void *data) {
+  struct follow *follow = data;
+
+  if (follow->between_values)
+    return false;
+  return wait_for_change_or_stop(follow, input);
+}
+
+bool follow_wait(struct follow *follow, struct input *input) {
+  if (!wait_for_change_or_stop(follow, input))
+    return false;
+
+  input->eof = false;
+  return true;
+}
+
+void follow_open(struct follow *follow, struct input *input, const char *path,
+                 const char *checkpoint_path) {
+  follow->path = path;
+  follow->watch_fd = -1;
+  follow->checkpoint_path = checkpoint_path;
+  follow->checkpoint_tmp = NULL;
+  follow->dirty = false;
+  follow->between_values = false;
+
+  int fd = open_file(follow);
+  if (fd < 0)
+    follow_error("cannot open", path);
+
+  size_t offset = 0;
+  if (checkpoint_path) {
+    size_t len = strlen(checkpoint_path);
+    follow->checkpoint_tmp = malloc(len + sizeof(".tmp"));
+    if (unlikely(!follow->checkpoint_tmp))
+      out_of_memory();
+    memcpy(follow->checkpoint_tmp, checkpoint_path, len);
+    memcpy(follow->checkpoint_tmp + len, ".tmp", sizeof(".tmp"));
+
+    offset = load_checkpoint(follow, fd);
+    if (offset != 0 && lseek(fd, offset, SEEK_SET) < 0)
+      follow_error("cannot seek", path);
+  }
+
+  /* stream offsets are offsets in the first file */
+  input->fd = fd;
+  input->offset = offset;
+  input->token = offset;
+  input->at_eof = wait_for_data;
+  input->at_eof_data = follow;
+  follow->file_start = 0;
+  follow->processed = offset;
+  clock_gettime(CLOCK_MONOTONIC, &follow->last_saved);
+
+  /* no SA_RESTART, so that waiting is interrupted */
+  struct sigaction action = { .sa_handler = request_stop };
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+}
+
+void follow_close(struct follow *follow, struct input *input) {
+  save_checkpoint(follow);
+  close(input->fd);
+  if (follow->watch_fd >= 0)
+    close(follow->watch_fd);
+  free(follow->checkpoint_tmp);
+}
+
+bool follow_stopped(struct follow *follow) {
+  (void)follow;
+  return stop_requested;
+}
+
+bool follow_processed(struct follow *follow, size_t offset) {
+  follow->processed = offset;
+  follow->dirty = true;
+
+  if (stop_requested)
+    return false;
+
+  if (follow->checkpoint_path) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (elapsed_ms(&follow->last_saved, &now) >= CHECKPOINT_INTERVAL_MS)
+      save_checkpoint(follow);
+  }
+
+  return true;
+}
@@ -0,0 +1,54 @@
+#ifndef _FOLLOW_H
+#define _FOLLOW_H
+
+#include "input.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Follow mode: read a file that keeps growing, reopen it when it is rotated
+ * and start over when it is truncated. Optionally persist the offset of the
+ * first value not yet processed, so that a restart resumes from there. */
+struct follow {
+  const char *path;
+  /* identity of the file being read */
+  dev_t dev;
+  ino_t ino;
+  /* stream offset of the first byte of the file being read */
+  size_t file_start;
+  /* inotify instance watching the file, or -1 */
+  int watch_fd;
+
+  const char *checkpoint_path;
+  /* the checkpoint is written here first and then renamed */
+  char *checkpoint_tmp;
+  /* stream offset of the first unprocessed value */
+  size_t processed;
+  /* set by the parser while it reads the first byte of a token outside of
+   * any value. The end of the file is then reported right away, so that the
+   * value before can be marked processed before waiting for more. */
+  bool between_values;
+  bool dirty;
+  struct timespec last_saved;
+};
+
+/* Open `path` as the input of `input`, resuming from the offset saved in
+ * `checkpoint_path` if given and still valid. */
+void follow_open(struct follow *follow, struct input *input, const char *path,
+                 const char *checkpoint_path);
+void follow_close(struct follow *follow, struct input *input);
+
+/* Record that everything before stream offset `offset` has been processed.
+ * Returns false once the process was asked to stop. */
+bool follow_processed(struct follow *follow, size_t offset);
+
+/* Wait until the file grows, after the end of the file was reported
+ * between values. Returns false once the process was asked to stop. */
+bool follow_wait(struct follow *follow, struct input *input);
+
+/* Whether the process was asked to stop. Reading then ends early, possibly in
+ * the middle of a value. */
+bool follow_stopped(struct follow *follow);
+
+#endif
@@ -0,0 +1,80 @@
+#include "framing.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+void framing_init(struct framing *framing, enum frame_format format,
+                  bool meta) {
+  framing->format = format;
+  framing->meta = meta;
+  framing->data = NULL;
+  framing->size = 0;
+  framing->buffer = open_memstream(&framing->data, &framing->size);
+  if (unlikely(!framing->buffer))
+    out_of_memory();
+
+  framing->target = NULL;
+  framing->selector = 0;
+  framing->label = FRAME_LABEL_NONE;
+  framing->key = NULL;
+  framing->keylen = 0;
+  framing->index = 0;
+}
+
+void framing_destroy(struct framing *framing) {
+  fclose(framing->buffer);
+  free(framing->data);
+}
+
+static void write_int(struct framing *framing, uint64_t value, FILE *out) {
+  if (framing->format == FRAME_U32) {
+    if (unlikely(value > UINT32_MAX)) {
+      fputs("frame field exceeds 32 bits", stderr);
+      exit(1);
+    }
+
+    unsigned char bytes[4] = {
+      value & 0xff,
+      value >> 8 & 0xff,
+      value >> 16 & 0xff,
+      value >> 24 & 0xff,
+    };
+    fwrite(bytes, 1, sizeof(bytes), out);
+    return;
+  }
+
+  unsigned char bytes[10];
+  size_t n = 0;
+  do {
+    bytes[n] = value & 0x7f;
+    value >>= 7;
+    if (value)
+      bytes[n] |= 0x80;
+    ++n;
+  } while (value);
+  fwrite(bytes, 1, n, out);
+}
+
+void framing_write(struct framing *framing, FILE *out) {
+  fflush(framing->buffer);
+  off_t length = ftello(framing->buffer);
+
+  if (framing->meta) {
+    write_int(framing, framing->selector, out);
+    fputc(framing->label, out);
+    if (framing->label == FRAME_LABEL_KEY) {
+      write_int(framing, framing->keylen, out);
+      fwrite(framing->key, 1, framing->keylen, out);
+    } else if (framing->label == FRAME_LABEL_INDEX) {
+      write_int(framing, framing->index, out);
+    }
+  }
+
+  write_int(framing, length, out);
+  fwrite(framing->data, 1, length, out);
+
+  fseeko(framing->buffer, 0, SEEK_SET);
+}
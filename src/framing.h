@@ -0,0 +1,52 @@
+#ifndef _FRAMING_H
+#define _FRAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum frame_format: unsigned char {
+  /* LEB128 */
+  FRAME_VARINT,
+  /* 32-bit little endian */
+  FRAME_U32,
+};
+
+enum frame_label: unsigned char {
+  FRAME_LABEL_NONE = 0,
+  FRAME_LABEL_KEY = 1,
+  FRAME_LABEL_INDEX = 2,
+};
+
+/* Length-prefixed output for --frame. A value is printed into `buffer`
+ * first, then written as its length followed by its bytes. With `meta`, the
+ * length is preceded by the index of the root selector that matched, a
+ * label kind, and the matched key as a length and bytes, or the matched
+ * index.
+ * All integers use `format`. */
+struct framing {
+  enum frame_format format;
+  bool meta;
+  FILE *buffer;
+  char *data;
+  size_t size;
+  /* where the frame goes while the value is printed into `buffer` */
+  FILE *target;
+
+  /* metadata of the value being printed */
+  size_t selector;
+  enum frame_label label;
+  const unsigned char *key;
+  size_t keylen;
+  size_t index;
+};
+
+void framing_init(struct framing *framing, enum frame_format format,
+                  bool meta);
+void framing_destroy(struct framing *framing);
+
+/* Write the value printed into the buffer as a frame to `out`, and empty
+ * the buffer. */
+void framing_write(struct framing *framing, FILE *out);
+
+#endif
@@ -0,0 +1,236 @@
+#include "group.h"
+#include "hash.h"
+#include "strpool.h"
+#include "utils.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *xrealloc(void *array, size_t size) {
+  void *new_array = realloc(array, size);
+  if (unlikely(!new_array && size != 0))
+    out_of_memory();
+
+  return new_array;
+}
+
+static void clear_record(struct group_table *table) {
+  table->has_key = false;
+  for (size_t i = 0; i < table->nvalue; ++i) {
+    table->record[i] = (struct group_aggregate) {
+      .count = 0,
+      .sum = 0.0,
+      .min = 0.0,
+      .max = 0.0,
+    };
+  }
+}
+
+static size_t *alloc_slots(size_t nslot) {
+  size_t *slots = xrealloc(NULL, nslot * sizeof(*slots));
+  for (size_t i = 0; i < nslot; ++i)
+    slots[i] = SIZE_MAX;
+
+  return slots;
+}
+
+void group_table_init(struct group_table *table, struct strpool *pool,
+                      size_t nvalue) {
+  table->pool = pool;
+  table->nvalue = nvalue;
+  table->entries = NULL;
+  table->nentry = 0;
+  table->entry_capacity = 0;
+  table->aggregates = NULL;
+  table->nslot = 1024;
+  table->slots = alloc_slots(table->nslot);
+  table->key = NULL;
+  table->key_length = 0;
+  table->key_capacity = 0;
+  table->record = xrealloc(NULL, nvalue * sizeof(*table->record));
+  clear_record(table);
+}
+
+void group_table_destroy(struct group_table *table) {
+  free(table->entries);
+  free(table->aggregates);
+  free(table->slots);
+  free(table->key);
+  free(table->record);
+}
+
+void group_table_set_key(struct group_table *table, const unsigned char *key,
+                         size_t length) {
+  if (table->has_key)
+    return;
+
+  if (length > table->key_capacity) {
+    table->key_capacity = max(length, 2 * table->key_capacity);
+    table->key = xrealloc(table->key, table->key_capacity);
+  }
+
+  memcpy(table->key, key, length);
+  table->key_length = length;
+  table->has_key = true;
+}
+
+static void fold(struct group_aggregate *into,
+                 const struct group_aggregate *from) {
+  if (from->count == 0)
+    return;
+
+  if (into->count == 0) {
+    *into = *from;
+    return;
+  }
+
+  into->count += from->count;
+  into->sum += from->sum;
+  into->min = min(into->min, from->min);
+  into->max = max(into->max, from->max);
+}
+
+void group_table_add_value(struct group_table *table, size_t index,
+                           double value) {
+  struct group_aggregate single = {
+    .count = 1,
+    .sum = value,
+    .min = value,
+    .max = value,
+  };
+  fold(&table->record[index], &single);
+}
+
+static void grow_slots(struct group_table *table) {
+  size_t nslot = table->nslot * 2;
+  size_t mask = nslot - 1;
+  size_t *slots = alloc_slots(nslot);
+
+  for (size_t i = 0; i < table->nentry; ++i) {
+    size_t j = table->entries[i].hash & mask;
+    while (slots[j] != SIZE_MAX)
+      j = (j + 1) & mask;
+    slots[j] = i;
+  }
+
+  free(table->slots);
+  table->slots = slots;
+  table->nslot = nslot;
+}
+
+static size_t find_entry(struct group_table *table) {
+  uint64_t hash = hash_bytes(table->key, table->key_length);
+  size_t mask = table->nslot - 1;
+
+  size_t i = hash & mask;
+  for (; table->slots[i] != SIZE_MAX; i = (i + 1) & mask) {
+    struct group_entry *entry = &table->entries[table->slots[i]];
+    if (entry->hash == hash && entry->length == table->key_length &&
+        memcmp(entry->key, table->key, table->key_length) == 0)
+      return table->slots[i];
+  }
+
+  if (table->nentry == table->entry_capacity) {
+    table->entry_capacity = table->entry_capacity ? 2 * table->entry_capacity
+                                                  : 256;
+    table->entries = xrealloc(table->entries, table->entry_capacity *
+                                                  sizeof(*table->entries));
+    table->aggregates =
+        xrealloc(table->aggregates, table->entry_capacity * table->nvalue *
+                                        sizeof(*table->aggregates));
+  }
+
+  unsigned char *key = strpool_alloc(table->pool, table->key_length);
+  memcpy(key, table->key, table->key_length);
+  strpool_commit(table->pool, table->key_length);
+
+  size_t index = table->nentry++;
+  table->entries[index] = (struct group_entry) {
+    .hash = hash,
+    .key = key,
+    .length = table->key_length,
+    .count = 0,
+  };
+  memset(&table->aggregates[index * table->nvalue], 0,
+         table->nvalue * sizeof(*table->aggregates));
+
+  table->slots[i] = index;
+  /* keep the load factor at most 1/2 */
+  if (2 * table->nentry > table->nslot)
+    grow_slots(table);
+
+  return index;
+}
+
+void group_table_commit(struct group_table *table) {
+  if (!table->has_key) {
+    clear_record(table);
+    return;
+  }
+
+  size_t index = find_entry(table);
+  ++table->entries[index].count;
+
+  struct group_aggregate *aggregates =
+      &table->aggregates[index * table->nvalue];
+  for (size_t i = 0; i < table->nvalue; ++i)
+    fold(&aggregates[i], &table->record[i]);
+
+  clear_record(table);
+}
+
+void group_table_discard(struct group_table *table) {
+  clear_record(table);
+}
+
+/* shortest of %.15g and %.17g that round-trips */
+static void print_number(double value, FILE *out) {
+  if (!isfinite(value)) {
+    fputs("null", out);
+    return;
+  }
+
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.15g", value);
+  if (strtod(buffer, NULL) != value)
+    snprintf(buffer, sizeof(buffer), "%.17g", value);
+
+  fputs(buffer, out);
+}
+
+void group_table_print(struct group_table *table, FILE *out) {
+  for (size_t i = 0; i < table->nentry; ++i) {
+    struct group_entry *entry = &table->entries[i];
+
+    fputs("{\"key\":", out);
+    fwrite(entry->key, 1, entry->length, out);
+    fprintf(out, ",\"count\":%zu", entry->count);
+
+    if (table->nvalue != 0) {
+      fputs(",\"values\":[", out);
+      for (size_t j = 0; j < table->nvalue; ++j) {
+        struct group_aggregate *aggregate =
+            &table->aggregates[i * table->nvalue + j];
+
+        if (j != 0)
+          fputc(',', out);
+        fprintf(out, "{\"count\":%zu,\"sum\":", aggregate->count);
+        print_number(aggregate->sum, out);
+        if (aggregate->count != 0) {
+          fputs(",\"min\":", out);
+          print_number(aggregate->min, out);
+          fputs(",\"max\":", out);
+          print_number(aggregate->max, out);
+        } else {
+          fputs(",\"min\":null,\"max\":null", out);
+        }
+        fputc('}', out);
+      }
+      fputc(']', out);
+    }
+
+    fputs("}\n", out);
+  }
+}
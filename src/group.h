@@ -0,0 +1,64 @@
+#ifndef _GROUP_H
+#define _GROUP_H
+
+#include "strpool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct group_aggregate {
+  size_t count;
+  double sum;
+  double min;
+  double max;
+};
+
+struct group_entry {
+  uint64_t hash;
+  /* JSON of the group key, with strings spelled canonically */
+  const unsigned char *key;
+  size_t length;
+  /* number of records with this key */
+  size_t count;
+};
+
+/* --group-by table, entries in insertion order */
+struct group_table {
+  struct strpool *pool;
+  size_t nvalue;
+  struct group_entry *entries;
+  size_t nentry;
+  size_t entry_capacity;
+  /* nvalue aggregates per entry, in the order of the entries */
+  struct group_aggregate *aggregates;
+  /* entry indices, or SIZE_MAX for an empty slot */
+  size_t *slots;
+  size_t nslot;
+
+  /* current record */
+  unsigned char *key;
+  size_t key_length;
+  size_t key_capacity;
+  bool has_key;
+  struct group_aggregate *record;
+};
+
+void group_table_init(struct group_table *table, struct strpool *pool,
+                      size_t nvalue);
+void group_table_destroy(struct group_table *table);
+
+void group_table_set_key(struct group_table *table, const unsigned char *key,
+                         size_t length);
+
+void group_table_add_value(struct group_table *table, size_t index,
+                           double value);
+
+/* records without a key are dropped */
+void group_table_commit(struct group_table *table);
+
+void group_table_discard(struct group_table *table);
+
+void group_table_print(struct group_table *table, FILE *out);
+
+#endif
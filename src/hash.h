@@ -0,0 +1,35 @@
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Finalizer of splitmix64, every input bit affects every output bit. */
+static inline uint64_t hash_mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+/* 64-bit hash of [p, p + length), consuming a word at a time. All bits of the
+ * result are usable, including as HyperLogLog input. */
+static inline uint64_t hash_bytes(const unsigned char *p, size_t length) {
+  uint64_t hash = 0x9e3779b97f4a7c15ull ^ length;
+
+  for (; length >= 8; p += 8, length -= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+    hash ^= hash >> 32;
+  }
+
+  uint64_t tail = 0;
+  memcpy(&tail, p, length);
+  return hash_mix(hash ^ tail);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#include "hll.h"
+
+#include <string.h>
+
+void hll_init(struct hll *hll) {
+  memset(hll->registers, 0, sizeof(hll->registers));
+}
+
+/* Natural logarithm of x >= 1, computed here so that libm is not needed:
+ * ln(x) = k ln(2) + 2 atanh((f - 1) / (f + 1)) where x = 2^k f, 1 <= f < 2. */
+static double natural_log(double x) {
+  int k = 0;
+  while (x >= 2.0) {
+    x /= 2.0;
+    ++k;
+  }
+
+  double z = (x - 1.0) / (x + 1.0);
+  double z2 = z * z;
+  double term = z;
+  double sum = 0.0;
+  /* z <= 1/3, so the terms shrink by at least 9 each step */
+  for (int i = 1; i < 40; i += 2) {
+    sum += term / i;
+    term *= z2;
+  }
+
+  return k * 0.6931471805599453 + 2.0 * sum;
+}
+
+double hll_estimate(const struct hll *hll) {
+  constexpr size_t m = 1 << HLL_PRECISION;
+
+  double sum = 0.0;
+  size_t zeros = 0;
+  for (size_t i = 0; i < m; ++i) {
+    sum += 1.0 / (double)(1ull << hll->registers[i]);
+    zeros += hll->registers[i] == 0;
+  }
+
+  double alpha = 0.7213 / (1.0 + 1.079 / m);
+  double estimate = alpha * m * m / sum;
+
+  /* small cardinalities are estimated better by linear counting; with a
+   * 64-bit hash no correction is needed for large ones */
+  if (estimate <= 2.5 * m && zeros != 0)
+    estimate = m * natural_log((double)m / zeros);
+
+  return estimate;
+}
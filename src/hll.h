@@ -0,0 +1,34 @@
+#ifndef _HLL_H
+#define _HLL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* log2 of the number of registers. The standard error of the estimate is
+ * about 1.04 / sqrt(2^HLL_PRECISION), 0.8% here. */
+constexpr unsigned HLL_PRECISION = 14;
+
+/* HyperLogLog sketch for --count-distinct. Each register holds the largest
+ * rank seen among the hashes routed to it, so memory stays fixed no matter
+ * how many values are added. */
+struct hll {
+  unsigned char registers[1 << HLL_PRECISION];
+};
+
+void hll_init(struct hll *hll);
+
+/* Add a value by its 64-bit hash, which must be uniformly distributed. */
+static inline void hll_add(struct hll *hll, uint64_t hash) {
+  size_t index = hash >> (64 - HLL_PRECISION);
+  /* the sentinel bit bounds the rank to 64 - HLL_PRECISION + 1 */
+  uint64_t rest = hash << HLL_PRECISION | 1ull << (HLL_PRECISION - 1);
+  unsigned char rank = __builtin_clzll(rest) + 1;
+
+  if (rank > hll->registers[index])
+    hll->registers[index] = rank;
+}
+
+/* Estimated number of distinct values added. */
+double hll_estimate(const struct hll *hll);
+
+#endif
@@ -0,0 +1,36 @@
+/* for madvise(2) and MAP_HUGETLB */
+#define _DEFAULT_SOURCE
+
+#include "hugepage.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+void *huge_alloc(size_t size) {
+  void *p = aligned_alloc(HUGE_PAGE_SIZE, size);
+  if (unlikely(!p))
+    out_of_memory();
+
+#if defined(MADV_HUGEPAGE)
+  /* only a hint, the memory is usable either way */
+  madvise(p, size, MADV_HUGEPAGE);
+#endif
+  return p;
+}
+
+void *huge_map(size_t size) {
+#if defined(MAP_HUGETLB)
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+#else
+  (void)size;
+  return NULL;
+#endif
+}
+
+void huge_unmap(void *p, size_t size) {
+  munmap(p, size);
+}
@@ -0,0 +1,25 @@
+#ifndef _HUGEPAGE_H
+#define _HUGEPAGE_H
+
+#include <stddef.h>
+
+/* Size of a huge page with 4 KiB base pages, on x86-64 and arm64. */
+constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+
+/* Round `size` up to a multiple of HUGE_PAGE_SIZE. */
+static inline size_t huge_page_round(size_t size) {
+  return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+/* Allocate `size` bytes, a multiple of HUGE_PAGE_SIZE, aligned to a huge
+ * page and advised to be backed by transparent huge pages. The memory is
+ * released with free(). */
+void *huge_alloc(size_t size);
+
+/* Map `size` bytes, a multiple of HUGE_PAGE_SIZE, from the pool of reserved
+ * huge pages. Returns NULL if there are not enough of them or the system has
+ * no such pool. */
+void *huge_map(size_t size);
+void huge_unmap(void *p, size_t size);
+
+#endif
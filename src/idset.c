@@ -0,0 +1,158 @@
+#include "idset.h"
+#include "hash.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+[[noreturn]] static void load_error(const char *path) {
+  fprintf(stderr, "cannot read %s: %s\n", path, strerror(errno));
+  exit(1);
+}
+
+static void read_file(struct id_set *set, const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0)
+    load_error(path);
+
+  /* room for a final newline, and for read() to see the end */
+  size_t capacity = S_ISREG(st.st_mode) && st.st_size > 0
+                        ? (size_t)st.st_size + 2
+                        : 1 << 16;
+  unsigned char *data = malloc(capacity);
+  if (unlikely(!data))
+    out_of_memory();
+
+  size_t size = 0;
+  while (true) {
+    if (capacity - size < 2) {
+      capacity *= 2;
+      data = realloc(data, capacity);
+      if (unlikely(!data))
+        out_of_memory();
+    }
+
+    ssize_t nread = read(fd, data + size, capacity - size - 1);
+    if (nread < 0 && errno == EINTR)
+      continue;
+    if (nread < 0)
+      load_error(path);
+    if (nread == 0)
+      break;
+    size += nread;
+
+    /* offsets are stored in 32 bits */
+    if (size >= UINT32_MAX) {
+      fprintf(stderr, "%s is too large\n", path);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  if (size == 0 || data[size - 1] != '\n')
+    data[size++] = '\n';
+  set->data = data;
+  set->size = size;
+}
+
+static uint64_t *alloc_zeroed(size_t count) {
+  uint64_t *array = calloc(count, sizeof(*array));
+  if (unlikely(!array))
+    out_of_memory();
+
+  return array;
+}
+
+static inline size_t id_length(const struct id_set *set, size_t offset) {
+  const unsigned char *newline =
+      memchr(set->data + offset, '\n', set->size - offset);
+  return newline - (set->data + offset);
+}
+
+static size_t find_slot(const struct id_set *set, uint64_t hash,
+                        const unsigned char *id, size_t length) {
+  size_t mask = set->nslot - 1;
+  uint64_t tag = hash >> 32;
+
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    uint64_t slot = set->slots[i];
+    if (slot == 0)
+      return i;
+
+    size_t offset = (uint32_t)slot - 1;
+    if (slot >> 32 == tag && offset + length < set->size) {
+      const unsigned char *member = set->data + offset;
+      if (member[length] == '\n' && memcmp(member, id, length) == 0)
+        return i;
+    }
+  }
+}
+
+bool id_set_lookup(const struct id_set *set, uint64_t hash,
+                   const unsigned char *id, size_t length) {
+  /* find_slot() relies on IDs ending in '\n' */
+  if (unlikely(memchr(id, '\n', length)))
+    return false;
+
+  return set->slots[find_slot(set, hash, id, length)] != 0;
+}
+
+void id_set_load(struct id_set *set, const char *path, struct match *key) {
+  read_file(set, path);
+
+  size_t nline = 0;
+  for (size_t i = 0; i < set->size; ++i)
+    nline += set->data[i] == '\n';
+
+  /* load factor at most 1/2, and 16 Bloom filter bits per ID */
+  set->nslot = 16;
+  while (set->nslot < 2 * nline)
+    set->nslot *= 2;
+  set->slots = alloc_zeroed(set->nslot);
+
+  size_t nblock = 1;
+  while (64 * nblock < 16 * nline)
+    nblock *= 2;
+  set->bloom = alloc_zeroed(nblock);
+  set->bloom_mask = nblock - 1;
+  set->count = 0;
+
+  for (size_t offset = 0; offset < set->size;) {
+    size_t length = id_length(set, offset);
+    size_t next = offset + length + 1;
+
+    if (length != 0 && set->data[offset + length - 1] == '\r') {
+      set->data[offset + length - 1] = '\n';
+      --length;
+    }
+
+    if (length != 0) {
+      const unsigned char *id = set->data + offset;
+      uint64_t hash = hash_bytes(id, length);
+      size_t i = find_slot(set, hash, id, length);
+      if (set->slots[i] == 0) {
+        set->slots[i] = (hash >> 32) << 32 | (uint64_t)(offset + 1);
+        set->bloom[hash >> 32 & set->bloom_mask] |= id_set_bloom_bits(hash);
+        ++set->count;
+      }
+    }
+
+    offset = next;
+  }
+
+  set->key = key;
+  set->testing = false;
+  set->found = false;
+}
+
+void id_set_destroy(struct id_set *set) {
+  free(set->data);
+  free(set->slots);
+  free(set->bloom);
+}
@@ -0,0 +1,50 @@
+#ifndef _IDSET_H
+#define _IDSET_H
+
+#include "hash.h"
+#include "match.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* --in-set IDs, with a blocked Bloom filter in front of the table */
+struct id_set {
+  /* file contents, every ID followed by '\n' */
+  unsigned char *data;
+  size_t size;
+  /* tag << 32 | (offset + 1) of the ID, or 0 for an empty slot */
+  uint64_t *slots;
+  size_t nslot;
+  /* 64-bit Bloom filter blocks */
+  uint64_t *bloom;
+  size_t bloom_mask;
+  size_t count;
+
+  struct match *key;
+  /* set while the key is being matched */
+  bool testing;
+  bool found;
+};
+
+void id_set_load(struct id_set *set, const char *path, struct match *key);
+void id_set_destroy(struct id_set *set);
+
+bool id_set_lookup(const struct id_set *set, uint64_t hash,
+                   const unsigned char *id, size_t length);
+
+static inline uint64_t id_set_bloom_bits(uint64_t hash) {
+  return 1ull << (hash & 63) | 1ull << (hash >> 6 & 63) |
+         1ull << (hash >> 12 & 63) | 1ull << (hash >> 18 & 63);
+}
+
+static inline bool id_set_contains(const struct id_set *set,
+                                   const unsigned char *id, size_t length) {
+  uint64_t hash = hash_bytes(id, length);
+  uint64_t bits = id_set_bloom_bits(hash);
+  if ((set->bloom[hash >> 32 & set->bloom_mask] & bits) != bits)
+    return false;
+
+  return id_set_lookup(set, hash, id, length);
+}
+
+#endif
@@ -0,0 +1,218 @@
+#include "input.h"
+#include "hugepage.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+constexpr size_t INPUT_BUFFER_SIZE = 1 << 18;
+
+[[noreturn]] static void read_error(void) {
+  fprintf(stderr, "read error: %s\n", strerror(errno));
+  exit(1);
+}
+
+/* Allocate a buffer of at least `*capacity` bytes plus padding. With huge
+ * pages, the capacity is enlarged to fill whole pages, and `*mapped` is set
+ * as for input->mapped. */
+static unsigned char *alloc_buffer(struct input *input, size_t *capacity,
+                                   size_t *mapped) {
+  *mapped = 0;
+  if (!input->huge_pages) {
+    unsigned char *buf = malloc(*capacity + INPUT_PADDING);
+    if (unlikely(!buf))
+      out_of_memory();
+    return buf;
+  }
+
+  size_t size = huge_page_round(*capacity + INPUT_PADDING);
+  *capacity = size - INPUT_PADDING;
+
+  unsigned char *buf = huge_map(size);
+  if (buf) {
+    *mapped = size;
+    return buf;
+  }
+
+  return huge_alloc(size);
+}
+
+static void free_buffer(unsigned char *buf, size_t mapped) {
+  if (mapped) {
+    huge_unmap(buf, mapped);
+  } else {
+    free(buf);
+  }
+}
+
+void input_init(struct input *input, int fd) {
+  size_t capacity = INPUT_BUFFER_SIZE;
+  input->huge_pages = false;
+  unsigned char *buf = alloc_buffer(input, &capacity, &input->mapped);
+
+  input->buf = buf;
+  input->curr = buf;
+  input->end = buf;
+  input->capacity = capacity;
+  input->offset = 0;
+  input->token = 0;
+  input->mark = INPUT_NO_MARK;
+  input->hold = INPUT_NO_MARK;
+  input->fd = fd;
+  input->eof = false;
+  input->before_read = NULL;
+  input->before_read_data = NULL;
+  input->at_eof = NULL;
+  input->at_eof_data = NULL;
+  input_advise_sequential(fd);
+}
+
+void input_advise_sequential(int fd) {
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+void input_destroy(struct input *input) {
+  free_buffer(input->buf, input->mapped);
+}
+
+void input_use_huge_pages(struct input *input) {
+  assert(input->curr == input->end);
+
+  free_buffer(input->buf, input->mapped);
+  input->huge_pages = true;
+
+  size_t capacity = max(input->capacity, HUGE_PAGE_SIZE - INPUT_PADDING);
+  input->buf = alloc_buffer(input, &capacity, &input->mapped);
+  input->curr = input->buf;
+  input->end = input->buf;
+  input->capacity = capacity;
+}
+
+/* Move unconsumed bytes, the current token and marked or held bytes to the
+ * front of the buffer. The buffer is grown so that kept bytes plus `size`
+ * bytes after the current position take at most half of it, which keeps
+ * reads large while a long token or marked span is being retained. */
+static void compact(struct input *input, size_t size) {
+  unsigned char *keep =
+      input_at(input, min(min(input->mark, input->hold), input->token));
+
+  size_t dropped = keep - input->buf;
+  size_t kept = input->curr - keep;
+  size_t remaining = input->end - keep;
+
+  if (unlikely(2 * (kept + size) > input->capacity)) {
+    size_t capacity = input->capacity;
+    while (capacity < 2 * (kept + size))
+      capacity *= 2;
+
+    size_t mapped;
+    unsigned char *buf = alloc_buffer(input, &capacity, &mapped);
+    memcpy(buf, keep, remaining);
+    free_buffer(input->buf, input->mapped);
+    input->buf = buf;
+    input->mapped = mapped;
+    input->capacity = capacity;
+  } else {
+    memmove(input->buf, keep, remaining);
+  }
+
+  input->offset += dropped;
+  input->curr = input->buf + kept;
+  input->end = input->buf + remaining;
+}
+
+/* Read once into the free tail of the buffer. Returns false on EOF. */
+static bool read_more(struct input *input) {
+  if (input->eof)
+    return false;
+
+  size_t space = input->buf + input->capacity - input->end;
+  assert(space != 0);
+
+  ssize_t nread;
+  do {
+    if (input->before_read)
+      input->before_read(input, input->before_read_data);
+
+    do {
+      nread = read(input->fd, input->end, space);
+    } while (unlikely(nread < 0 && errno == EINTR));
+
+    if (unlikely(nread < 0))
+      read_error();
+  } while (nread == 0 && input->at_eof &&
+           input->at_eof(input, input->at_eof_data));
+
+  if (nread == 0) {
+    input->eof = true;
+    return false;
+  }
+
+  input->end += nread;
+  return true;
+}
+
+bool input_fill_fallback(struct input *input) {
+  assert(input->curr == input->end);
+
+  compact(input, 1);
+  return read_more(input);
+}
+
+bool input_ensure_fallback(struct input *input, size_t size) {
+  compact(input, size);
+
+  while ((size_t)(input->end - input->curr) < size) {
+    if (!read_more(input))
+      return false;
+  }
+
+  return true;
+}
+
+void input_seek(struct input *input, size_t offset) {
+  if (unlikely(lseek(input->fd, (off_t)offset, SEEK_SET) < 0)) {
+    fprintf(stderr, "cannot seek the input: %s\n", strerror(errno));
+    exit(1);
+  }
+
+  input->curr = input->buf;
+  input->end = input->buf;
+  input->offset = offset;
+  input->token = offset;
+  input->eof = false;
+}
+
+bool input_skip_line(struct input *input) {
+  while (true) {
+    unsigned char *newline =
+        memchr(input->curr, '\n', input->end - input->curr);
+    if (newline) {
+      input->curr = newline + 1;
+      return true;
+    }
+
+    input->curr = input->end;
+    if (!input_fill(input))
+      return false;
+  }
+}
+
+bool input_skip(struct input *input, size_t size) {
+  while ((size_t)(input->end - input->curr) < size) {
+    size -= input->end - input->curr;
+    input->curr = input->end;
+    /* not kept as part of the current token either */
+    input->token = input_tell(input);
+    if (!input_fill(input))
+      return false;
+  }
+
+  input->curr += size;
+  return true;
+}
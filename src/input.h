@@ -0,0 +1,151 @@
+#ifndef _INPUT_H
+#define _INPUT_H
+
+#include "utils.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Bytes readable past `end` without faulting, so vectorized scanners may
+ * load a full register at the tail of the buffer. */
+constexpr size_t INPUT_PADDING = 64;
+
+constexpr size_t INPUT_NO_MARK = SIZE_MAX;
+
+struct input {
+  unsigned char *curr;
+  unsigned char *end;
+  unsigned char *buf;
+  size_t capacity;
+  /* stream offset of buf[0] */
+  size_t offset;
+  /* stream offset of the first byte of the current token */
+  size_t token;
+  /* stream offset from which bytes are kept in the buffer across refills,
+   * or INPUT_NO_MARK. The current token is always kept. */
+  size_t mark;
+  /* like `mark`, but set by input_hold() for a whole record and left alone
+   * by input_mark() and input_unmark() */
+  size_t hold;
+  int fd;
+  bool eof;
+  /* buffers are backed by huge pages */
+  bool huge_pages;
+  /* size of the buffer mapping if it is from the reserved huge page pool,
+   * else 0 and it is released with free() */
+  size_t mapped;
+  /* called before every read(2) of the input, or NULL */
+  void (*before_read)(struct input *input, void *data);
+  void *before_read_data;
+  /* called when read(2) reaches the end of the input, or NULL. Returns true
+   * if reading should be retried. */
+  bool (*at_eof)(struct input *input, void *data);
+  void *at_eof_data;
+};
+
+void input_init(struct input *input, int fd);
+
+/* Ask for a larger read-ahead on `fd`, as inputs are read front to back.
+ * Fails harmlessly on pipes. */
+void input_advise_sequential(int fd);
+void input_destroy(struct input *input);
+
+/* Replace the buffer, which must be empty, by a larger one backed by huge
+ * pages, and allocate later buffers the same way. */
+void input_use_huge_pages(struct input *input);
+
+bool input_fill_fallback(struct input *input);
+bool input_ensure_fallback(struct input *input, size_t size);
+
+/* Reposition the input to stream offset `offset`, discarding buffered bytes.
+ * Exits if the input is not seekable. */
+void input_seek(struct input *input, size_t offset);
+
+/* Skip past the next newline. Returns false if the input ends first. */
+bool input_skip_line(struct input *input);
+
+/* Skip the next `size` bytes without keeping them, unless they are marked.
+ * Returns false if the input ends first. */
+bool input_skip(struct input *input, size_t size);
+
+/* Make sure at least one byte is available. Returns false on EOF. */
+static inline bool input_fill(struct input *input) {
+  if (likely(input->curr != input->end))
+    return true;
+
+  return input_fill_fallback(input);
+}
+
+/* Make sure at least `size` bytes are available. Returns false if the stream
+ * ends before that. */
+static inline bool input_ensure(struct input *input, size_t size) {
+  if (likely((size_t)(input->end - input->curr) >= size))
+    return true;
+
+  return input_ensure_fallback(input, size);
+}
+
+static inline int input_getc(struct input *input) {
+  if (unlikely(!input_fill(input)))
+    return EOF;
+
+  return *input->curr++;
+}
+
+/* Push back the byte just returned by input_getc(). Must not be called after
+ * input_getc() returned EOF. */
+static inline void input_ungetc(struct input *input) {
+  --input->curr;
+}
+
+static inline size_t input_tell(struct input *input) {
+  return input->offset + (size_t)(input->curr - input->buf);
+}
+
+/* Stream offset just past the last byte read so far. */
+static inline size_t input_read_offset(struct input *input) {
+  return input->offset + (size_t)(input->end - input->buf);
+}
+
+/* Record that the byte just returned by input_getc() starts a token. */
+static inline void input_start_token(struct input *input) {
+  input->token = input_tell(input) - 1;
+}
+
+/* Keep the bytes from stream offset `offset` on in the buffer until
+ * input_unmark(). `offset` must not be before the start of the buffer. */
+static inline void input_mark(struct input *input, size_t offset) {
+  assert(offset >= input->offset && offset <= input_tell(input));
+  input->mark = offset;
+}
+
+static inline void input_unmark(struct input *input) {
+  input->mark = INPUT_NO_MARK;
+}
+
+/* Keep the bytes from stream offset `offset` on in the buffer until
+ * input_release(), under any marks set in between. */
+static inline void input_hold(struct input *input, size_t offset) {
+  assert(offset >= input->offset && offset <= input_tell(input));
+  input->hold = offset;
+}
+
+static inline void input_release(struct input *input) {
+  input->hold = INPUT_NO_MARK;
+}
+
+/* Address of a byte at stream offset `offset`, which must still be buffered. */
+static inline unsigned char *input_at(struct input *input, size_t offset) {
+  assert(offset >= input->offset);
+  return input->buf + (offset - input->offset);
+}
+
+/* Move back to stream offset `offset`, which must still be buffered, to read
+ * the bytes from there again. */
+static inline void input_rewind(struct input *input, size_t offset) {
+  input->curr = input_at(input, offset);
+}
+
+#endif
@@ -1,22 +1,286 @@
+#include "decoder.h"
+#include "encoder.h"
+#include "flush.h"
+#include "follow.h"
+#include "framing.h"
+#include "group.h"
+#include "hll.h"
+#include "idset.h"
+#include "input.h"
 #include "parser.h"
+#include "partition.h"
+#include "profile.h"
+#include "sample.h"
 #include "match.h"
 #include "strpool.h"
+#include "tape.h"
+#include "top.h"
+#include "unique.h"
+#include "utils.h"
+#include "validate.h"
 
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+/* options without a short form */
+enum {
+  OPT_SHARD = UCHAR_MAX + 1,
+  OPT_BYTE_RANGE,
+  OPT_MAX_OPEN,
+  OPT_UNIQUE,
+  OPT_COUNT_DISTINCT,
+  OPT_GROUP_BY,
+  OPT_TOP,
+  OPT_IN_SET,
+  OPT_SET_KEY,
+  OPT_PROJECT,
+  OPT_DELETE,
+  OPT_MASK,
+  OPT_FRAME,
+  OPT_FRAME_META,
+  OPT_OUTPUT_FORMAT,
+  OPT_INPUT_FORMAT,
+  OPT_SPECULATE,
+  OPT_VALIDATE,
+  OPT_SKIP_INVALID,
+  OPT_ERROR_FILE,
+  OPT_HUGE_PAGES,
+};
+
+static const struct option long_options[] = {
+  {"shard", required_argument, NULL, OPT_SHARD},
+  {"byte-range", required_argument, NULL, OPT_BYTE_RANGE},
+  {"max-open", required_argument, NULL, OPT_MAX_OPEN},
+  {"unique", no_argument, NULL, OPT_UNIQUE},
+  {"count-distinct", no_argument, NULL, OPT_COUNT_DISTINCT},
+  {"group-by", no_argument, NULL, OPT_GROUP_BY},
+  {"top", required_argument, NULL, OPT_TOP},
+  {"in-set", required_argument, NULL, OPT_IN_SET},
+  {"set-key", required_argument, NULL, OPT_SET_KEY},
+  {"project", no_argument, NULL, OPT_PROJECT},
+  {"delete", no_argument, NULL, OPT_DELETE},
+  {"mask", required_argument, NULL, OPT_MASK},
+  {"frame", required_argument, NULL, OPT_FRAME},
+  {"frame-meta", no_argument, NULL, OPT_FRAME_META},
+  {"output-format", required_argument, NULL, OPT_OUTPUT_FORMAT},
+  {"input-format", required_argument, NULL, OPT_INPUT_FORMAT},
+  {"speculate", no_argument, NULL, OPT_SPECULATE},
+  {"validate", no_argument, NULL, OPT_VALIDATE},
+  {"skip-invalid", no_argument, NULL, OPT_SKIP_INVALID},
+  {"error-file", required_argument, NULL, OPT_ERROR_FILE},
+  {"huge-pages", no_argument, NULL, OPT_HUGE_PAGES},
+  {NULL, 0, NULL, 0},
+};
+
 struct options {
   const char *match;
+  const char *follow;
+  const char *checkpoint;
   const char *delimiter;
+  const char *partition;
+  const char *output;
+  const char *in_set;
+  const char *set_key;
+  size_t max_open;
   bool print_raw;
   bool stream;
   bool null_sep;
   bool flush_stdout;
+  size_t flush_buffer_size;
+  unsigned long flush_delay_ms;
+  bool passthrough;
+  bool minify;
+  bool project;
+  bool delete;
+  const char *mask;
+  bool frame;
+  enum frame_format frame_format;
+  bool frame_meta;
+  /* --output-format other than json */
+  bool encode;
+  enum encoding encoding;
+  /* --input-format other than json */
+  bool decode;
+  enum encoding decoding;
+  bool tape;
+  bool speculate;
+  /* check the input instead of matching, no match is needed */
+  bool validate;
+  /* drop records with errors in stream mode, listing them in error_file if
+   * it is set */
+  bool skip_invalid;
+  const char *error_file;
+  /* back input buffers and string pools with huge pages */
+  bool huge_pages;
+  bool unique;
+  bool count_distinct;
+  bool group_by;
+  size_t top;
+  size_t max_depth;
+  size_t limit;
+  size_t sample_every;
+  double sample_probability;
+  uint64_t sample_seed;
+  /* records on lines starting in [range_start, range_end) are processed */
+  size_t range_start;
+  size_t range_end;
+  /* --shard I/N, resolved to a byte range once the input size is known */
+  size_t shard_index;
+  size_t shard_count;
 };
 
+static size_t parse_size(const char *arg, const char *what) {
+  char *end;
+  unsigned long long value = strtoull(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || value == 0 || value > SIZE_MAX) {
+    fprintf(stderr, "invalid %s: %s\n", what, arg);
+    exit(1);
+  }
+
+  return value;
+}
+
+/* -F BYTES[,MS] */
+static void parse_flush(const char *arg, struct options *options) {
+  char *end;
+  unsigned long long size = strtoull(arg, &end, 10);
+  unsigned long long delay = options->flush_delay_ms;
+
+  if (end != arg && *end == ',') {
+    const char *delay_arg = end + 1;
+    delay = strtoull(delay_arg, &end, 10);
+    if (end == delay_arg)
+      end = (char *)arg;
+  }
+
+  if (end == arg || *end != '\0' || size == 0 || size > SIZE_MAX ||
+      delay > ULONG_MAX) {
+    fprintf(stderr, "invalid flush policy: %s\n", arg);
+    exit(1);
+  }
+
+  options->flush_stdout = true;
+  options->flush_buffer_size = size;
+  options->flush_delay_ms = delay;
+}
+
+/* -R PROBABILITY[,SEED] */
+static void parse_random_sample(const char *arg, struct options *options) {
+  char *end;
+  double probability = strtod(arg, &end);
+  unsigned long long seed = time(NULL);
+
+  if (end != arg && *end == ',') {
+    const char *seed_arg = end + 1;
+    seed = strtoull(seed_arg, &end, 10);
+    if (end == seed_arg)
+      end = (char *)arg;
+  }
+
+  if (end == arg || *end != '\0' ||
+      !(probability > 0.0 && probability <= 1.0)) {
+    fprintf(stderr, "invalid sampling probability: %s\n", arg);
+    exit(1);
+  }
+
+  options->sample_probability = probability;
+  options->sample_seed = seed;
+  options->stream = true;
+}
+
+/* --shard I/N */
+static void parse_shard(const char *arg, struct options *options) {
+  char *end;
+  unsigned long long index = strtoull(arg, &end, 10);
+  unsigned long long count = 0;
+
+  if (end != arg && *end == '/') {
+    const char *count_arg = end + 1;
+    count = strtoull(count_arg, &end, 10);
+    if (end == count_arg)
+      end = (char *)arg;
+  }
+
+  if (end == arg || *end != '\0' || count == 0 || count > SIZE_MAX ||
+      index >= count) {
+    fprintf(stderr, "invalid shard: %s\n", arg);
+    exit(1);
+  }
+
+  options->shard_index = index;
+  options->shard_count = count;
+  options->stream = true;
+}
+
+/* --byte-range START:END, either bound may be omitted */
+static void parse_byte_range(const char *arg, struct options *options) {
+  char *end;
+  unsigned long long start = 0;
+  unsigned long long stop = SIZE_MAX;
+
+  if (*arg != ':')
+    start = strtoull(arg, &end, 10);
+  else
+    end = (char *)arg;
+
+  if (*end == ':' && end[1] != '\0') {
+    const char *stop_arg = end + 1;
+    stop = strtoull(stop_arg, &end, 10);
+    if (end == stop_arg)
+      end = (char *)arg;
+  } else if (*end == ':') {
+    ++end;
+  } else {
+    end = (char *)arg;
+  }
+
+  if (*end != '\0' || start > SIZE_MAX || stop > SIZE_MAX || start > stop) {
+    fprintf(stderr, "invalid byte range: %s\n", arg);
+    exit(1);
+  }
+
+  options->range_start = start;
+  options->range_end = stop;
+  options->stream = true;
+}
+
+/* Return `s` as a quoted JSON string, in a new buffer. */
+static char *quote_json(const char *s) {
+  char *quoted = malloc(6 * strlen(s) + 3);
+  if (!quoted)
+    out_of_memory();
+
+  char *out = quoted;
+  *out++ = '"';
+  for (; *s; ++s) {
+    unsigned char ch = *s;
+    if (ch == '"' || ch == '\\') {
+      *out++ = '\\';
+      *out++ = ch;
+    } else if (ch < 0x20) {
+      out += sprintf(out, "\\u%04X", ch);
+    } else {
+      *out++ = ch;
+    }
+  }
+  *out++ = '"';
+  *out = '\0';
+
+  return quoted;
+}
+
 static void parse_options(int argc, char *const *argv,
                           struct options *options) {
   int opt;
-  while ((opt = getopt(argc, argv, "+s0rfd:")) != -1) {
+  while ((opt = getopt_long(argc, argv, "+s0rfpmtd:D:F:w:c:n:S:R:P:o:",
+                            long_options, NULL)) != -1) {
     switch (opt) {
       case 'f': {
         options->flush_stdout = true;
@@ -30,10 +294,179 @@ static void parse_options(int argc, char *const *argv,
         options->print_raw = true;
         break;
       }
+      case 'p': {
+        options->passthrough = true;
+        break;
+      }
+      case 'm': {
+        options->minify = true;
+        break;
+      }
+      case 't': {
+        options->tape = true;
+        break;
+      }
       case 'd': {
         options->delimiter = optarg;
         break;
       }
+      case 'D': {
+        options->max_depth = parse_size(optarg, "depth");
+        break;
+      }
+      case 'F': {
+        parse_flush(optarg, options);
+        break;
+      }
+      case 'w': {
+        options->follow = optarg;
+        options->stream = true;
+        break;
+      }
+      case 'c': {
+        options->checkpoint = optarg;
+        break;
+      }
+      case 'n': {
+        options->limit = parse_size(optarg, "limit");
+        break;
+      }
+      case 'S': {
+        options->sample_every = parse_size(optarg, "sampling interval");
+        options->stream = true;
+        break;
+      }
+      case 'R': {
+        parse_random_sample(optarg, options);
+        break;
+      }
+      case 'P': {
+        options->partition = optarg;
+        options->stream = true;
+        break;
+      }
+      case 'o': {
+        options->output = optarg;
+        break;
+      }
+      case OPT_MAX_OPEN: {
+        options->max_open = parse_size(optarg, "number of open files");
+        break;
+      }
+      case OPT_UNIQUE: {
+        options->unique = true;
+        break;
+      }
+      case OPT_COUNT_DISTINCT: {
+        options->count_distinct = true;
+        break;
+      }
+      case OPT_GROUP_BY: {
+        options->group_by = true;
+        options->stream = true;
+        break;
+      }
+      case OPT_TOP: {
+        options->top = parse_size(optarg, "number of records");
+        options->stream = true;
+        break;
+      }
+      case OPT_IN_SET: {
+        options->in_set = optarg;
+        options->stream = true;
+        break;
+      }
+      case OPT_SET_KEY: {
+        options->set_key = optarg;
+        break;
+      }
+      case OPT_PROJECT: {
+        options->project = true;
+        break;
+      }
+      case OPT_DELETE: {
+        options->delete = true;
+        break;
+      }
+      case OPT_MASK: {
+        options->mask = optarg;
+        break;
+      }
+      case OPT_FRAME: {
+        if (strcmp(optarg, "varint") == 0) {
+          options->frame_format = FRAME_VARINT;
+        } else if (strcmp(optarg, "u32") == 0) {
+          options->frame_format = FRAME_U32;
+        } else {
+          fprintf(stderr, "invalid frame format: %s\n", optarg);
+          exit(1);
+        }
+        options->frame = true;
+        break;
+      }
+      case OPT_FRAME_META: {
+        options->frame_meta = true;
+        break;
+      }
+      case OPT_OUTPUT_FORMAT: {
+        if (strcmp(optarg, "json") == 0) {
+          options->encode = false;
+        } else if (strcmp(optarg, "msgpack") == 0) {
+          options->encode = true;
+          options->encoding = ENCODING_MSGPACK;
+        } else if (strcmp(optarg, "cbor") == 0) {
+          options->encode = true;
+          options->encoding = ENCODING_CBOR;
+        } else {
+          fprintf(stderr, "invalid output format: %s\n", optarg);
+          exit(1);
+        }
+        break;
+      }
+      case OPT_INPUT_FORMAT: {
+        if (strcmp(optarg, "json") == 0) {
+          options->decode = false;
+        } else if (strcmp(optarg, "msgpack") == 0) {
+          options->decode = true;
+          options->decoding = ENCODING_MSGPACK;
+        } else if (strcmp(optarg, "cbor") == 0) {
+          options->decode = true;
+          options->decoding = ENCODING_CBOR;
+        } else {
+          fprintf(stderr, "invalid input format: %s\n", optarg);
+          exit(1);
+        }
+        break;
+      }
+      case OPT_SPECULATE: {
+        options->speculate = true;
+        break;
+      }
+      case OPT_VALIDATE: {
+        options->validate = true;
+        break;
+      }
+      case OPT_SKIP_INVALID: {
+        options->skip_invalid = true;
+        break;
+      }
+      case OPT_ERROR_FILE: {
+        options->skip_invalid = true;
+        options->error_file = optarg;
+        break;
+      }
+      case OPT_HUGE_PAGES: {
+        options->huge_pages = true;
+        break;
+      }
+      case OPT_SHARD: {
+        parse_shard(optarg, options);
+        break;
+      }
+      case OPT_BYTE_RANGE: {
+        parse_byte_range(optarg, options);
+        break;
+      }
       case '0': {
         options->null_sep = true;
         break;
@@ -46,52 +479,555 @@ static void parse_options(int argc, char *const *argv,
 
   if (optind < argc) {
     options->match = argv[optind];
-  } else {
+  } else if (!options->validate) {
     fprintf(stderr, "You must specify a match\n");
     exit(1);
   }
+
+  if (options->checkpoint && !options->follow) {
+    fprintf(stderr, "A checkpoint requires following a file with -w\n");
+    exit(1);
+  }
+
+  if (options->output && !options->partition) {
+    fprintf(stderr, "An output file name requires partitioning with -P\n");
+    exit(1);
+  }
+
+  if (options->output && !strstr(options->output, "{}")) {
+    fprintf(stderr, "The output file name must contain {}\n");
+    exit(1);
+  }
+
+  if (options->count_distinct && (options->unique || options->partition)) {
+    fprintf(stderr,
+            "--count-distinct cannot be combined with --unique or -P\n");
+    exit(1);
+  }
+
+  if (options->group_by &&
+      (options->unique || options->count_distinct || options->partition)) {
+    fprintf(stderr, "--group-by cannot be combined with --unique, "
+                    "--count-distinct or -P\n");
+    exit(1);
+  }
+
+  if (options->top && (options->unique || options->count_distinct ||
+                       options->group_by || options->partition)) {
+    fprintf(stderr, "--top cannot be combined with --unique, "
+                    "--count-distinct, --group-by or -P\n");
+    exit(1);
+  }
+
+  if (options->project && (options->unique || options->count_distinct ||
+                           options->group_by || options->top)) {
+    fprintf(stderr, "--project cannot be combined with --unique, "
+                    "--count-distinct, --group-by or --top\n");
+    exit(1);
+  }
+
+  bool redact = options->delete || options->mask;
+  bool ranged = options->shard_count || options->range_start ||
+                options->range_end != SIZE_MAX;
+  if (options->delete && options->mask) {
+    fprintf(stderr, "--delete and --mask are mutually exclusive\n");
+    exit(1);
+  }
+
+  if (redact && (options->unique || options->count_distinct ||
+                 options->group_by || options->top || options->project)) {
+    fprintf(stderr, "--delete and --mask cannot be combined with --unique, "
+                    "--count-distinct, --group-by, --top or --project\n");
+    exit(1);
+  }
+
+  if (options->encode &&
+      (options->print_raw || options->passthrough || options->minify ||
+       options->project || redact || options->count_distinct ||
+       options->group_by || options->top)) {
+    fprintf(stderr, "--output-format cannot be combined with -r, -p, -m, "
+                    "--project, --delete, --mask, --count-distinct, "
+                    "--group-by or --top\n");
+    exit(1);
+  }
+
+  /* these copy or scan the input as JSON text */
+  if (options->decode &&
+      (options->passthrough || options->minify || options->project ||
+       redact || options->group_by || options->top || options->tape ||
+       options->speculate || options->sample_every ||
+       options->sample_probability > 0.0 || ranged)) {
+    fprintf(stderr, "--input-format cannot be combined with -p, -m, -t, "
+                    "-S, -R, --project, --delete, --mask, --group-by, "
+                    "--top, --speculate, --shard or --byte-range\n");
+    exit(1);
+  }
+
+  if (options->validate && (options->follow || options->partition ||
+                            options->decode || ranged)) {
+    fprintf(stderr, "--validate cannot be combined with -w, -P, "
+                    "--input-format, --shard or --byte-range\n");
+    exit(1);
+  }
+
+  if (options->skip_invalid && !options->stream) {
+    fprintf(stderr, "--skip-invalid and --error-file require -s\n");
+    exit(1);
+  }
+
+  /* records are resynchronized on newlines of the JSON text */
+  if (options->skip_invalid && (options->follow || options->decode)) {
+    fprintf(stderr, "--skip-invalid and --error-file cannot be combined "
+                    "with -w or --input-format\n");
+    exit(1);
+  }
+
+  if (options->frame_meta && !options->frame) {
+    fprintf(stderr, "--frame-meta requires --frame\n");
+    exit(1);
+  }
+
+  if (options->set_key && !options->in_set) {
+    fprintf(stderr, "--set-key requires --in-set\n");
+    exit(1);
+  }
+
+  if (ranged && options->follow) {
+    fprintf(stderr, "Sharding cannot be combined with -w\n");
+    exit(1);
+  }
+
+  if (options->shard_count && (options->range_start ||
+                               options->range_end != SIZE_MAX)) {
+    fprintf(stderr, "--shard and --byte-range are mutually exclusive\n");
+    exit(1);
+  }
+}
+
+/* The {KEY,VALUE...} multimatch of --group-by, which may be under a path
+ * as in .a{.k,.v}. Returns NULL if there is none, and every match is then
+ * a key. */
+static struct match *group_multimatch(struct match *match) {
+  while (match && match->nselector == 1)
+    match = match->selectors[0].submatch;
+  return match;
+}
+
+/* Split the input into `count` byte ranges of nearly equal size. The last
+ * shard is left open-ended so that data appended meanwhile is not lost. */
+static void resolve_shard(struct options *options, int fd) {
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    fprintf(stderr, "--shard requires a regular file as input\n");
+    exit(1);
+  }
+
+  size_t size = st.st_size;
+  size_t count = options->shard_count;
+  size_t index = options->shard_index;
+  size_t step = size / count;
+  size_t rest = size % count;
+
+  /* index * size / count without overflow */
+  options->range_start = index * step + index * rest / count;
+  options->range_end = index + 1 == count
+                           ? SIZE_MAX
+                           : (index + 1) * step + (index + 1) * rest / count;
+}
+
+/* Run --validate over the standard input. In stream mode the number of
+ * valid records before the first error is printed as well. */
+static int validate(const struct options *options) {
+  struct input input;
+  input_init(&input, STDIN_FILENO);
+  if (options->huge_pages)
+    input_use_huge_pages(&input);
+
+  struct validator validator;
+  validator_init(&validator, &input, options->max_depth);
+
+  bool valid = options->stream ? validate_stream(&validator)
+                               : validate_text(&validator);
+  if (options->stream)
+    printf("%zu\n", validator.records);
+  if (!valid)
+    fprintf(stderr, "error in offset %zu: %s\n", validator.error_offset,
+            validator.error);
+
+  validator_destroy(&validator);
+  input_destroy(&input);
+  return valid ? 0 : 1;
+}
+
+/* Position the input at the first record starting at or after `start`. A
+ * record starts at `start` only if the byte before it is a newline. */
+static void seek_to_record(struct input *input, size_t start) {
+  if (start == 0)
+    return;
+
+  input_seek(input, start - 1);
+  input_skip_line(input);
 }
 
 int main(int argc, char **argv) {
   struct options options = {
     .match = NULL,
+    .follow = NULL,
+    .checkpoint = NULL,
     .delimiter = NULL,
+    .partition = NULL,
+    .output = NULL,
+    .in_set = NULL,
+    .set_key = NULL,
+    .max_open = 64,
     .print_raw = false,
     .stream = false,
     .null_sep = false,
     .flush_stdout = false,
+    .flush_buffer_size = 1 << 16,
+    .flush_delay_ms = 100,
+    .passthrough = false,
+    .minify = false,
+    .project = false,
+    .delete = false,
+    .mask = NULL,
+    .frame = false,
+    .frame_format = FRAME_VARINT,
+    .frame_meta = false,
+    .encode = false,
+    .encoding = ENCODING_MSGPACK,
+    .decode = false,
+    .decoding = ENCODING_MSGPACK,
+    .tape = false,
+    .speculate = false,
+    .validate = false,
+    .skip_invalid = false,
+    .error_file = NULL,
+    .huge_pages = false,
+    .unique = false,
+    .count_distinct = false,
+    .group_by = false,
+    .top = 0,
+    .max_depth = SIZE_MAX,
+    .limit = SIZE_MAX,
+    .sample_every = 0,
+    .sample_probability = 0.0,
+    .sample_seed = 0,
+    .range_start = 0,
+    .range_end = SIZE_MAX,
+    .shard_index = 0,
+    .shard_count = 0,
   };
 
   parse_options(argc, argv, &options);
 
+  if (options.validate)
+    return validate(&options);
+
   struct match *match = match_parse(options.match);
 
   struct strpool strpool;
   strpool_init(&strpool);
 
+  struct input input;
+  input_init(&input, STDIN_FILENO);
+
+  if (options.huge_pages) {
+    strpool_use_huge_pages(&strpool);
+    input_use_huge_pages(&input);
+  }
+
   struct parser parser = {
-    .file = stdin,
+    .input = &input,
     .strpool = &strpool,
     .print_option = PRINT_NONE,
     .delimiter = options.delimiter ? options.delimiter : "\n",
+    .out = stdout,
+    .containers = NULL,
+    .ncontainer = 0,
+    .container_capacity = 0,
+    .frames = NULL,
+    .nframe = 0,
+    .frame_capacity = 0,
+    .max_depth = options.max_depth,
+    .tape = NULL,
+    .flush = NULL,
+    .follow = NULL,
+    .in_set = NULL,
+    .partition = NULL,
+    .unique = NULL,
+    .distinct = NULL,
+    .groups = NULL,
+    .top = NULL,
+    .decoder = NULL,
+    .unread = 0,
+    .encoder = NULL,
+    .framing = NULL,
+    .projection = NULL,
+    .redaction = NULL,
+    .scratch = NULL,
+    .scratch_capacity = 0,
+    .resync = NULL,
+    .sampler = NULL,
+    .speculate = options.speculate,
+    .limit = options.limit,
+    .line_start = 0,
+    .range_end = options.range_end,
   };
 
+  if (options.shard_count) {
+    resolve_shard(&options, STDIN_FILENO);
+    parser.range_end = options.range_end;
+  }
+
+  seek_to_record(&input, options.range_start);
+  parser.line_start = input_tell(&input);
+
+  /* without --set-key, the values tested are the ones printed */
+  struct match *set_key = NULL;
+  struct id_set in_set;
+  if (options.in_set) {
+    set_key = options.set_key ? match_parse(options.set_key) : match;
+    id_set_load(&in_set, options.in_set, set_key);
+    parser.in_set = &in_set;
+  }
+
+  struct match *partition_key = NULL;
+  struct partition partition;
+  if (options.partition) {
+    partition_key = match_parse(options.partition);
+    partition_init(&partition, partition_key,
+                   options.output ? options.output : "{}", options.max_open);
+    parser.partition = &partition;
+  }
+
+  /* keys of --unique live in their own pool, which is never freed from */
+  struct strpool unique_pool;
+  struct value_set unique;
+  if (options.unique) {
+    strpool_init(&unique_pool);
+    if (options.huge_pages)
+      strpool_use_huge_pages(&unique_pool);
+    value_set_init(&unique, &unique_pool);
+    parser.unique = &unique;
+  }
+
+  struct hll *distinct = NULL;
+  if (options.count_distinct) {
+    distinct = malloc(sizeof(*distinct));
+    if (!distinct)
+      out_of_memory();
+    hll_init(distinct);
+    parser.distinct = distinct;
+  }
+
+  /* the match is {KEY, VALUE...}, keys live in their own pool */
+  struct strpool group_pool;
+  struct group_table groups;
+  if (options.group_by) {
+    strpool_init(&group_pool);
+    if (options.huge_pages)
+      strpool_use_huge_pages(&group_pool);
+    struct match *multimatch = group_multimatch(match);
+    group_table_init(&groups, &group_pool,
+                     multimatch ? multimatch->nselector - 1 : 0);
+    parser.groups = &groups;
+  }
+
+  /* the match picks the number records are ranked by */
+  struct top top;
+  if (options.top) {
+    top_init(&top, options.top);
+    parser.top = &top;
+  }
+
+  struct sampler sampler;
+  if (options.sample_every) {
+    sampler_init_every(&sampler, options.sample_every);
+    parser.sampler = &sampler;
+  } else if (options.sample_probability > 0.0) {
+    sampler_init_random(&sampler, options.sample_probability,
+                        options.sample_seed);
+    parser.sampler = &sampler;
+  }
+
+  struct follow follow;
+  if (options.follow) {
+    follow_open(&follow, &input, options.follow, options.checkpoint);
+    parser.follow = &follow;
+  }
+
+  struct tape tape;
+  if (options.tape) {
+    tape_init(&tape);
+    parser.tape = &tape;
+  }
+
   if (options.print_raw)
     parser.print_option |= PRINT_RAW;
 
   if (options.null_sep)
     parser.print_option |= PRINT_NULL_SEP;
 
-  if (options.flush_stdout)
+  struct flush_policy flush;
+  if (options.flush_stdout) {
+    flush_policy_init(&flush, options.flush_buffer_size,
+                      options.flush_delay_ms);
+    input.before_read = flush_policy_before_read;
+    input.before_read_data = &flush;
+    parser.flush = &flush;
     parser.print_option |= PRINT_FLUSH_STDOUT;
+  }
+
+  if (options.passthrough)
+    parser.print_option |= PRINT_PASSTHROUGH;
 
+  if (options.minify)
+    parser.print_option |= PRINT_PASSTHROUGH | PRINT_MINIFY;
+
+  struct projection projection;
+  if (options.project) {
+    projection = (struct projection) {
+      .levels = NULL,
+      .nlevel = 0,
+      .level_capacity = 0,
+      .keys = NULL,
+      .keys_length = 0,
+      .keys_capacity = 0,
+    };
+    parser.projection = &projection;
+    parser.print_option |= PRINT_PROJECT | PRINT_PASSTHROUGH | PRINT_MINIFY;
+  }
+
+  struct decoder decoder;
+  if (options.decode) {
+    decoder_init(&decoder, options.decoding);
+    parser.decoder = &decoder;
+  }
+
+  struct encoder encoder;
+  if (options.encode) {
+    encoder_init(&encoder, options.encoding);
+    parser.encoder = &encoder;
+  }
+
+  struct framing framing;
+  if (options.frame) {
+    framing_init(&framing, options.frame_format, options.frame_meta);
+    parser.framing = &framing;
+  }
+
+  /* the mask is printed as a JSON string */
+  struct redaction redaction;
+  char *mask = NULL;
+  if (options.delete || options.mask) {
+    if (options.mask)
+      mask = quote_json(options.mask);
+    redaction = (struct redaction) {
+      .mask = mask,
+      .cursor = 0,
+      .trim = false,
+      .dropped = false,
+    };
+    parser.redaction = &redaction;
+  }
+
+  struct resync resync;
+  if (options.skip_invalid) {
+    resync = (struct resync) {
+      .errors = NULL,
+      .data = NULL,
+      .size = 0,
+      .committed = 0,
+      .target = stdout,
+      .record = 0,
+      .limit = SIZE_MAX,
+      .error_offset = 0,
+      .skipped = 0,
+    };
+    resync.staging = open_memstream(&resync.data, &resync.size);
+    if (!resync.staging)
+      out_of_memory();
+    if (options.error_file) {
+      resync.errors = fopen(options.error_file, "w");
+      if (!resync.errors) {
+        fprintf(stderr, "cannot open %s: %s\n", options.error_file,
+                strerror(errno));
+        exit(1);
+      }
+    }
+    parser.out = resync.staging;
+    parser.resync = &resync;
+  }
+
+  PROFILE_START();
   if (options.stream) {
     start_stream_matching(&parser, match);
   } else {
     start_matching(&parser, match);
   }
+  PROFILE_REPORT(stderr, input_tell(&input));
 
+  free(mask);
+  if (options.skip_invalid) {
+    fclose(resync.staging);
+    free(resync.data);
+    if (resync.errors && fclose(resync.errors) != 0) {
+      fprintf(stderr, "write error: %s\n", strerror(errno));
+      exit(1);
+    }
+    if (resync.skipped)
+      fprintf(stderr, "%zu invalid records skipped\n", resync.skipped);
+  }
+  if (options.decode)
+    decoder_destroy(&decoder);
+  if (options.encode)
+    encoder_destroy(&encoder);
+  if (options.frame)
+    framing_destroy(&framing);
+
+  if (options.count_distinct) {
+    printf("%.0f\n", hll_estimate(distinct));
+    free(distinct);
+  }
+
+  if (options.group_by) {
+    group_table_print(&groups, stdout);
+    group_table_destroy(&groups);
+    strpool_destroy(&group_pool);
+  }
+
+  if (options.top) {
+    if (options.null_sep) {
+      top_print(&top, stdout, "", 1);
+    } else {
+      top_print(&top, stdout, parser.delimiter, strlen(parser.delimiter));
+    }
+    top_destroy(&top);
+  }
+
+  if (options.unique) {
+    value_set_destroy(&unique);
+    strpool_destroy(&unique_pool);
+  }
+
+  if (options.follow)
+    follow_close(&follow, &input);
+  if (options.in_set) {
+    id_set_destroy(&in_set);
+    if (set_key != match)
+      match_delete(set_key);
+  }
+
+  if (options.partition) {
+    partition_destroy(&partition);
+    match_delete(partition_key);
+  }
+  parser_destroy(&parser);
+  if (options.tape)
+    tape_destroy(&tape);
   strpool_destroy(&strpool);
+  input_destroy(&input);
   match_delete(match);
 
   return 0;
@@ -1,7 +1,9 @@
 #include "match.h"
+#include "dfa.h"
 #include "utils.h"
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -148,6 +150,91 @@ static struct string parse_string(struct parse_state *state) {
   return ret;
 }
 
+/* Read the text of a regular expression, quoted or up to the end of the
+ * key, with its escapes left for the regex compiler. */
+static struct string parse_raw(struct parse_state *state) {
+  bool quoted = *state->current == '"';
+  const char *begin = state->current + quoted;
+  const char *p = begin;
+
+  while (quoted ? *p != '"' : !strchr("{}[.,", *p)) {
+    if (*p == '\\' && p[1] != '\0')
+      ++p;
+    if (*p == '\0')
+      break;
+    ++p;
+  }
+
+  if (quoted && *p != '"') {
+    state->current = p;
+    error(state, "unterminated string");
+  }
+
+  struct string ret = {
+    .buf = malloc(p - begin),
+    .length = p - begin,
+  };
+  if (unlikely(!ret.buf && ret.length))
+    error(state, "out of memory");
+
+  memcpy(ret.buf, begin, ret.length);
+  state->current = p + quoted;
+  return ret;
+}
+
+/* Whether the unquoted key at the current position has an unescaped '*' or
+ * '?', which makes it a glob. */
+static bool is_glob(struct parse_state *state) {
+  for (const char *p = state->current; !strchr("{}[.,", *p); ++p) {
+    if (*p == '*' || *p == '?')
+      return true;
+    if (*p == '\\' && p[1] != '\0')
+      ++p;
+  }
+  return false;
+}
+
+/* Translate the glob at the current position into an anchored regular
+ * expression, with every literal byte escaped. */
+static struct string parse_glob(struct parse_state *state) {
+  const char *begin = state->current;
+  size_t length = calc_strlen(state, "{}[.,");
+  state->current = begin;
+
+  unsigned char *buf = malloc(4 * length + 2);
+  if (unlikely(!buf))
+    error(state, "out of memory");
+
+  unsigned char *out = buf;
+  *out++ = '^';
+  for (size_t i = 0; i < length; ++i) {
+    unsigned char ch = *state->current++;
+    if (ch == '*') {
+      *out++ = '.';
+      *out++ = '*';
+      continue;
+    }
+    if (ch == '?') {
+      *out++ = '.';
+      continue;
+    }
+
+    if (ch == '\\')
+      ch = escaped_char(state);
+    if ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'z') {
+      *out++ = ch;
+    } else {
+      out += sprintf((char *)out, "\\x%02X", ch);
+    }
+  }
+  *out++ = '$';
+
+  return (struct string) {
+    .buf = buf,
+    .length = out - buf,
+  };
+}
+
 static struct match *parse_primary(struct parse_state *state);
 
 static struct selector parse_selector(struct parse_state *state) {
@@ -155,9 +242,25 @@ static struct selector parse_selector(struct parse_state *state) {
 
   switch (*state->current++) {
     case '.': {
-      if (*state->current == '*') {
+      if (*state->current == '*' && strchr("{}[.,", state->current[1])) {
         ++state->current;
         selector.type = MATCH_ALL_KEY;
+      } else if (*state->current == '~' ||
+                 (*state->current != '"' && is_glob(state))) {
+        bool regex = *state->current == '~';
+        state->current += regex;
+        const char *begin = state->current;
+        struct string pattern = regex ? parse_raw(state) : parse_glob(state);
+
+        const char *message;
+        selector.type = MATCH_PATTERN;
+        selector.expected.dfa = dfa_compile(pattern.buf, pattern.length,
+                                            &message);
+        free(pattern.buf);
+        if (!selector.expected.dfa) {
+          state->current = begin;
+          error(state, "%s", message);
+        }
       } else {
         struct string key = parse_string(state);
         selector.type = MATCH_KEY;
@@ -211,6 +314,7 @@ static struct match *realloc_match(struct parse_state *state, struct match *ptr,
 static struct match *parse_singlematch(struct parse_state *state) {
   struct match *match = realloc_match(state, NULL, 1);
   struct selector selector = parse_selector(state);
+  match->chain = NULL;
   match->nselector = 1;
   match->selectors[0] = selector;
 
@@ -227,6 +331,7 @@ static struct match *parse_multimatch(struct parse_state *state) {
   if (unlikely(!match))
     error(state, "out of memory");
 
+  match->chain = NULL;
   match->nselector = 0;
 
   while (*state->current != '\0') {
@@ -266,6 +371,42 @@ static struct match *parse_primary(struct parse_state *state) {
   }
 }
 
+static struct chain *compile_chain(struct parse_state *state,
+                                   struct match *match) {
+  size_t nstep = 0;
+  for (struct match *m = match; m; m = m->selectors[0].submatch) {
+    if (m->nselector != 1)
+      return NULL;
+    ++nstep;
+  }
+
+  struct chain *chain =
+      malloc(sizeof(struct chain) + sizeof(struct step) * nstep);
+  if (unlikely(!chain))
+    error(state, "out of memory");
+
+  chain->nstep = nstep;
+  struct step *step = chain->steps;
+  for (struct match *m = match; m; m = m->selectors[0].submatch) {
+    struct selector *selector = &m->selectors[0];
+    step->selector = selector;
+    step->type = selector->type;
+    step->predicted_member = SIZE_MAX;
+    step->confidence = 0;
+    if (selector->type == MATCH_KEY) {
+      step->expected.key = selector->expected.key;
+      step->expected_keylen = selector->expected_keylen;
+    } else if (selector->type == MATCH_PATTERN) {
+      step->expected.dfa = selector->expected.dfa;
+    } else {
+      step->expected.index = selector->expected.index;
+    }
+    ++step;
+  }
+
+  return chain;
+}
+
 struct match *match_parse(const char *command) {
   struct parse_state state = {
     .command = command,
@@ -276,6 +417,9 @@ struct match *match_parse(const char *command) {
   if (unlikely(*state.current != '\0'))
     error(&state, "unexpected character");
 
+  if (match)
+    match->chain = compile_chain(&state, match);
+
   return match;
 }
 
@@ -287,6 +431,9 @@ void match_delete(struct match *match) {
     match_delete(match->selectors[i].submatch);
     if (match->selectors[i].type == MATCH_KEY)
       free(match->selectors[i].expected.key);
+    if (match->selectors[i].type == MATCH_PATTERN)
+      dfa_delete(match->selectors[i].expected.dfa);
   }
+  free(match->chain);
   free(match);
 }
@@ -8,6 +8,8 @@ enum selector_type: unsigned char {
   MATCH_INDEX,
   MATCH_ALL_KEY,
   MATCH_KEY,
+  /* keys matching a glob or regular expression */
+  MATCH_PATTERN,
 };
 
 static inline bool can_match_key(enum selector_type type) {
@@ -23,6 +25,7 @@ struct selector {
   union {
     unsigned char *key;
     size_t index;
+    struct dfa *dfa;
   } expected;
   union {
     unsigned char *key;
@@ -33,7 +36,32 @@ struct selector {
   enum selector_type type;
 };
 
+/* One level of a linear selector chain, such as ".a.b" or ".items[*].id",
+ * where every match has exactly one selector. */
+struct step {
+  struct selector *selector;
+  union {
+    unsigned char *key;
+    size_t index;
+    struct dfa *dfa;
+  } expected;
+  unsigned int expected_keylen;
+  enum selector_type type;
+  /* for key order speculation: the member index the key was last found
+   * at, or SIZE_MAX, and how many times in a row it was found there */
+  size_t predicted_member;
+  unsigned char confidence;
+};
+
+struct chain {
+  size_t nstep;
+  struct step steps[];
+};
+
 struct match {
+  /* flat form of the whole match if it is a linear chain. Only set on the
+   * match returned by match_parse(). */
+  struct chain *chain;
   size_t nselector;
   struct selector selectors[];
 };
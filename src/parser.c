@@ -1,6 +1,23 @@
 #include "parser.h"
+#include "flush.h"
+#include "follow.h"
+#include "decoder.h"
+#include "dfa.h"
+#include "framing.h"
+#include "group.h"
+#include "hash.h"
+#include "hll.h"
+#include "idset.h"
+#include "input.h"
 #include "match.h"
+#include "partition.h"
+#include "profile.h"
+#include "sample.h"
+#include "simd.h"
 #include "strpool.h"
+#include "tape.h"
+#include "top.h"
+#include "unique.h"
 #include "utils.h"
 
 #include <limits.h>
@@ -9,12 +26,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <wchar.h>
 
 [[noreturn]] static void error(struct parser *parser, const char *fmt, ...) {
   va_list ap;
 
-  fprintf(stderr, "error in offset %ld: ", ftell(parser->file));
+  /* Follow mode was stopped in the middle of a value. The checkpoint is
+   * before the value, so it is processed again on a restart. */
+  if (parser->follow && follow_stopped(parser->follow)) {
+    fflush(stdout);
+    exit(0);
+  }
+
+  if (parser->resync) {
+    va_start(ap, fmt);
+    vsnprintf(parser->resync->message, sizeof(parser->resync->message), fmt,
+              ap);
+    va_end(ap);
+    parser->resync->error_offset = input_tell(parser->input);
+    longjmp(parser->resync->recover, 1);
+  }
+
+  fprintf(stderr, "error in offset %zu: ", input_tell(parser->input));
   va_start(ap, fmt);
   vfprintf(stderr, fmt, ap);
   va_end(ap);
@@ -41,30 +73,34 @@ static inline bool is_cntrl(int ch) {
   return ch < 32 || ch == 127;
 }
 
+static inline bool is_space(int ch) {
+  return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
 #define PARSE_NUMBER(on_get)                                                   \
   do {                                                                         \
     do {                                                                       \
       on_get;                                                                  \
-    } while (is_digit(ch = fgetc(parser->file)));                              \
+    } while (is_digit(ch = input_getc(parser->input)));                        \
                                                                                \
     if (ch == '.') {                                                           \
       do {                                                                     \
         on_get;                                                                \
-      } while (is_digit(ch = fgetc(parser->file)));                            \
+      } while (is_digit(ch = input_getc(parser->input)));                      \
     }                                                                          \
                                                                                \
     if (ch == 'e' || ch == 'E') {                                              \
       on_get;                                                                  \
-      ch = fgetc(parser->file);                                                \
+      ch = input_getc(parser->input);                                          \
       if (ch == '+' || ch == '-' || is_digit(ch)) {                            \
         do {                                                                   \
           on_get;                                                              \
-        } while (is_digit(ch = fgetc(parser->file)));                          \
+        } while (is_digit(ch = input_getc(parser->input)));                    \
       }                                                                        \
     }                                                                          \
                                                                                \
     if (likely(ch != EOF))                                                     \
-      ungetc(ch, parser->file);                                                \
+      input_ungetc(parser->input);                                             \
   } while (0);
 
 static inline void parse_number(struct parser *parser, int ch) {
@@ -85,11 +121,7 @@ static inline void parse_number(struct parser *parser, int ch) {
   lex_return(TK_NUMBER);
 }
 
-static wint_t escaped_char(struct parser *parser) {
-  int ch = fgetc(parser->file);
-  if (unlikely(ch == EOF))
-    error(parser, "unterminated string");
-
+static inline unsigned char simple_escape(unsigned char ch) {
   switch (ch) {
     case 'a':
       return '\a';
@@ -107,23 +139,66 @@ static wint_t escaped_char(struct parser *parser) {
       return '\r';
     case '0':
       return '\0';
-    case 'u': {
-      char digits[5];
-      for (size_t i = 0; i < ARRAY_SIZE(digits) - 1; ++i) {
-        if (unlikely((ch = fgetc(parser->file)) == EOF))
-          error(parser, "unterminated string");
-        digits[i] = ch;
-      }
-      digits[ARRAY_SIZE(digits) - 1] = '\0';
-      return (wint_t)strtoul(digits, NULL, 16);
-    }
-    case '\\':
-      return '\\';
     default:
       return ch;
   }
 }
 
+/* 0x10 | value for hex digits, 0 otherwise, so that and-ing the entries of
+ * four digits tells whether all of them are valid. */
+static const unsigned char hex_table[256] = {
+  ['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+  ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+  ['a'] = 0x1A, ['b'] = 0x1B, ['c'] = 0x1C, ['d'] = 0x1D, ['e'] = 0x1E,
+  ['f'] = 0x1F, ['A'] = 0x1A, ['B'] = 0x1B, ['C'] = 0x1C, ['D'] = 0x1D,
+  ['E'] = 0x1E, ['F'] = 0x1F,
+};
+
+/* Decode 4 hex digits at `p`. Returns a value above 0xFFFF if any of them is
+ * not a hex digit. */
+static inline unsigned long decode_hex4(const unsigned char *p) {
+  unsigned char d0 = hex_table[p[0]];
+  unsigned char d1 = hex_table[p[1]];
+  unsigned char d2 = hex_table[p[2]];
+  unsigned char d3 = hex_table[p[3]];
+  unsigned long value = (unsigned long)(d0 & 0xF) << 12 | (d1 & 0xF) << 8 |
+                        (d2 & 0xF) << 4 | (d3 & 0xF);
+  return (d0 & d1 & d2 & d3 & 0x10) ? value : 0x10000;
+}
+
+constexpr unsigned long REPLACEMENT_CHARACTER = 0xFFFD;
+
+/* Decode the code point of a '\uXXXX' escape whose "\u" has been consumed.
+ * A high surrogate followed by a '\uXXXX' low surrogate is combined into one
+ * code point; unpaired surrogates decode to U+FFFD. */
+static unsigned long unicode_escape(struct parser *parser) {
+  struct input *input = parser->input;
+  if (unlikely(!input_ensure(input, 4)))
+    error(parser, "unterminated string");
+
+  unsigned long codepoint = decode_hex4(input->curr);
+  if (unlikely(codepoint > 0xFFFF))
+    error(parser, "invalid unicode escape");
+  input->curr += 4;
+
+  if (likely(codepoint < 0xD800 || codepoint > 0xDFFF))
+    return codepoint;
+
+  if (codepoint > 0xDBFF)
+    return REPLACEMENT_CHARACTER;
+
+  if (!input_ensure(input, 6) || input->curr[0] != '\\' ||
+      input->curr[1] != 'u')
+    return REPLACEMENT_CHARACTER;
+
+  unsigned long low = decode_hex4(input->curr + 2);
+  if (low < 0xDC00 || low > 0xDFFF)
+    return REPLACEMENT_CHARACTER;
+
+  input->curr += 6;
+  return 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+}
+
 static size_t encode_utf8_len(unsigned long ch) {
   if (ch <= 0x7F) {
     return 1;
@@ -155,36 +230,60 @@ static void encode_utf8(unsigned long ch, unsigned char *buffer) {
     }
 }
 
+/* Grow the string buffer of parse_string() to hold at least `size` bytes. */
+static inline unsigned char *reserve(struct parser *parser,
+                                     unsigned char *buffer, size_t *bufsize,
+                                     size_t size) {
+  if (likely(size <= *bufsize))
+    return buffer;
+
+  size_t new_size = *bufsize;
+  while (new_size < size)
+    new_size *= 2;
+
+  *bufsize = new_size;
+  return strpool_realloc(parser->strpool, new_size);
+}
+
 static void parse_string(struct parser *parser) {
+  struct input *input = parser->input;
   size_t bufsize = 256;
   unsigned char *buffer = strpool_alloc(parser->strpool, bufsize);
   size_t currpos = 0;
 
-
   while (true) {
-    int ch = fgetc(parser->file);
-    if (unlikely(ch == EOF))
-      error(parser, "unterminated string");
+    /* copy the run up to the next quote or backslash in one go */
+    unsigned char *run = input->curr;
+    unsigned char *stop = simd_find2(run, input->end, '"', '\\');
+    size_t len = stop - run;
+    buffer = reserve(parser, buffer, &bufsize, currpos + len);
+    memcpy(buffer + currpos, run, len);
+    currpos += len;
+    input->curr = stop;
+
+    if (unlikely(stop == input->end)) {
+      if (unlikely(!input_fill(input)))
+        error(parser, "unterminated string");
+      continue;
+    }
 
-    if (ch == '"')
+    ++input->curr;
+    if (likely(*stop == '"'))
       break;
 
-    if (unlikely(currpos == bufsize)) {
-      bufsize *= 2;
-      buffer = strpool_realloc(parser->strpool, bufsize);
-    }
+    int ch = input_getc(input);
+    if (unlikely(ch == EOF))
+      error(parser, "unterminated string");
 
-    if (unlikely(ch == '\\')) {
-      unsigned long ch = escaped_char(parser);
-      size_t len = encode_utf8_len(ch);
-      if (unlikely(len + currpos > bufsize)) {
-        bufsize += len;
-        buffer = strpool_realloc(parser->strpool, bufsize);
-      }
-      encode_utf8(ch, buffer + currpos);
+    if (ch == 'u') {
+      unsigned long codepoint = unicode_escape(parser);
+      size_t len = encode_utf8_len(codepoint);
+      buffer = reserve(parser, buffer, &bufsize, currpos + len);
+      encode_utf8(codepoint, buffer + currpos);
       currpos += len;
     } else {
-      buffer[currpos++] = ch;
+      buffer = reserve(parser, buffer, &bufsize, currpos + 1);
+      buffer[currpos++] = simple_escape(ch);
     }
   }
 
@@ -194,12 +293,232 @@ static void parse_string(struct parser *parser) {
   lex_return(TK_STRING);
 }
 
-static void next(struct parser *parser) {
+/* Copy the next `length` bytes of the input to `buffer` at `currpos`, which
+ * is grown in the string pool as needed. */
+static unsigned char *copy_payload(struct parser *parser,
+                                   unsigned char *buffer, size_t *bufsize,
+                                   size_t currpos, uint64_t length) {
+  struct input *input = parser->input;
+
+  if (unlikely(length > SIZE_MAX - currpos))
+    error(parser, "string too long");
+  buffer = reserve(parser, buffer, bufsize, currpos + length);
+
+  while (length != 0) {
+    if (unlikely(!input_fill(input)))
+      error(parser, "unterminated string");
+
+    size_t len = min(length, (uint64_t)(input->end - input->curr));
+    memcpy(buffer + currpos, input->curr, len);
+    input->curr += len;
+    currpos += len;
+    length -= len;
+  }
+
+  return buffer;
+}
+
+/* Read the payload of a string or binary with head `item` into the string
+ * pool. Chunks of an indefinite length one are joined. */
+static void read_payload(struct parser *parser, struct item *item) {
+  size_t bufsize = max(item->indefinite ? 256 : item->value, 1);
+  unsigned char *buffer = strpool_alloc(parser->strpool, bufsize);
+  size_t currpos = 0;
+
+  if (!item->indefinite) {
+    buffer = copy_payload(parser, buffer, &bufsize, 0, item->value);
+    currpos = item->value;
+  } else {
+    struct item chunk;
+    while (decoder_read(parser->decoder, parser->input, &chunk),
+           chunk.type != ITEM_BREAK) {
+      if (unlikely(chunk.type != item->type || chunk.indefinite))
+        error(parser, "invalid string chunk");
+      buffer = copy_payload(parser, buffer, &bufsize, currpos, chunk.value);
+      currpos += chunk.value;
+    }
+  }
+
+  parser->attr.string = buffer;
+  parser->length = currpos;
+}
+
+/* Give out the integer or float `item` as the text of a JSON number. */
+static void format_number(struct parser *parser, struct item *item) {
+  constexpr size_t size = 32;
+  unsigned char *buffer = strpool_alloc(parser->strpool, size);
+  char *text = (char *)buffer;
+  int length;
+
+  if (item->type == ITEM_UINT) {
+    length = snprintf(text, size, "%llu", (unsigned long long)item->value);
+  } else if (item->type == ITEM_NEGATIVE) {
+    if (item->value <= INT64_MAX) {
+      length = snprintf(text, size, "%lld", -1 - (long long)item->value);
+    } else if (item->value != UINT64_MAX) {
+      length = snprintf(text, size, "-%llu",
+                        (unsigned long long)item->value + 1);
+    } else {
+      length = snprintf(text, size, "-18446744073709551616");
+    }
+  } else {
+    /* the shortest precision that reads back the same */
+    for (int precision = 15; precision <= 17; ++precision) {
+      length = snprintf(text, size, "%.*g", precision, item->number);
+      if (strtod(text, NULL) == item->number)
+        break;
+    }
+  }
+
+  parser->attr.number = buffer;
+  parser->length = length;
+}
+
+/* Lexer for --input-format: give out the items of MessagePack or CBOR input
+ * as the tokens of the equivalent JSON, with ',' and ':' in between. The
+ * payload of a string value is left in the input until load_string() is
+ * called, so that skipping it costs no more than its length and never
+ * needs a buffer as large. */
+static void next_item(struct parser *parser) {
+  struct decoder *decoder = parser->decoder;
+  struct input *input = parser->input;
+  struct decoder_level *level = decoder_top(decoder);
+
+  if (parser->unread) {
+    if (unlikely(!input_skip(input, parser->unread)))
+      error(parser, "unterminated string");
+    parser->unread = 0;
+  }
+
+  if (level && level->state != LEVEL_BEFORE_ITEM) {
+    bool end = level->indefinite ? decoder_at_break(decoder, input)
+                                 : level->remaining == 0;
+    if (end) {
+      if (level->indefinite)
+        input_getc(input);
+      input->token = input_tell(input) - level->indefinite;
+      --decoder->nlevel;
+      lex_return(level->map ? TK_RBRACE : TK_RBRACKET);
+    }
+
+    if (level->state == LEVEL_AFTER_ITEM) {
+      level->state = LEVEL_BEFORE_ITEM;
+      input->token = input_tell(input);
+      lex_return(level->map && !level->key ? TK_COLON : TK_COMMA);
+    }
+  }
+
+  struct item item;
+  decoder_save(decoder);
+  decoder_read(decoder, input, &item);
+
+  bool key = false;
+  if (level) {
+    if (unlikely(item.type == ITEM_EOF))
+      error(parser, "unexpected EOF");
+    if (!level->indefinite)
+      --level->remaining;
+    level->state = LEVEL_AFTER_ITEM;
+    key = level->map && level->key;
+    level->key = level->map && !level->key;
+  }
+
+  switch (item.type) {
+    case ITEM_UINT:
+    case ITEM_NEGATIVE:
+      format_number(parser, &item);
+      if (key) {
+        parser->attr.string = parser->attr.number;
+        lex_return(TK_STRING);
+      }
+      lex_return(TK_NUMBER);
+    case ITEM_STRING:
+    case ITEM_BINARY:
+      if (key || item.indefinite) {
+        read_payload(parser, &item);
+      } else {
+        if (unlikely(item.value > UINT_MAX))
+          error(parser, "string too long");
+        /* until load_string(), and for good if empty */
+        parser->attr.string = zero_buffer;
+        parser->length = item.value;
+        parser->unread = item.value;
+      }
+      lex_return(TK_STRING);
+    case ITEM_EOF:
+      input->token = input_tell(input);
+      lex_return(TK_EOF);
+    case ITEM_INVALID:
+      error(parser, "invalid item");
+    case ITEM_BREAK:
+      error(parser, "unexpected break");
+    default:
+      break;
+  }
+
+  if (unlikely(key))
+    error(parser, "map keys must be strings or integers");
+
+  switch (item.type) {
+    case ITEM_FLOAT:
+      /* JSON has no infinities and NaNs */
+      if (item.number - item.number != 0)
+        lex_return(TK_NULL);
+      format_number(parser, &item);
+      lex_return(TK_NUMBER);
+    case ITEM_ARRAY:
+    case ITEM_MAP: {
+      bool map = item.type == ITEM_MAP;
+      if (unlikely(map && item.value > UINT64_MAX / 2))
+        error(parser, "invalid item");
+      decoder_push(decoder, map, &item);
+      lex_return(map ? TK_LBRACE : TK_LBRACKET);
+    }
+    case ITEM_FALSE:
+    case ITEM_TRUE:
+      parser->attr.boolean = item.type == ITEM_TRUE;
+      lex_return(TK_BOOL);
+    default:
+      lex_return(TK_NULL);
+  }
+}
+
+/* Make the string value just lexed by next_item() available in
+ * parser->attr.string. */
+static inline void load_string(struct parser *parser) {
+  struct input *input = parser->input;
+
+  if (likely(!parser->unread))
+    return;
+
+  if (unlikely(!input_ensure(input, parser->unread)))
+    error(parser, "unterminated string");
+  parser->attr.string = input->curr;
+  input->curr += parser->unread;
+  parser->unread = 0;
+}
+
+static void lex(struct parser *parser) {
+  if (unlikely(parser->decoder)) {
+    next_item(parser);
+    return;
+  }
+
 retry:
-  int ch = fgetc(parser->file);
+  /* see follow_wait() */
+  if (unlikely(parser->follow) && parser->input->curr == parser->input->end) {
+    parser->follow->between_values =
+        parser->ncontainer == 0 && parser->nframe == 0;
+    input_fill(parser->input);
+    parser->follow->between_values = false;
+  }
 
-  if (unlikely(ch == EOF))
+  int ch = input_getc(parser->input);
+
+  if (unlikely(ch == EOF)) {
+    parser->input->token = input_tell(parser->input);
     lex_return(TK_EOF);
+  }
 
   if (unlikely(ch < 0))
     unreachable();
@@ -207,6 +526,8 @@ retry:
   if (unlikely(ch > 255))
     unreachable();
 
+  input_start_token(parser->input);
+
   switch (ch) {
     case ':':
       lex_return(TK_COLON);
@@ -237,20 +558,20 @@ retry:
     case 't': {
       parser->attr.boolean = ch == 'f' ? false : true;
 
-      while (is_alpha(ch = fgetc(parser->file)))
+      while (is_alpha(ch = input_getc(parser->input)))
         continue;
 
       if (unlikely(ch != EOF))
-        ungetc(ch, parser->file);
+        input_ungetc(parser->input);
       
       lex_return(TK_BOOL);
     }
     case 'n': {
-      while (is_alpha(ch = fgetc(parser->file)))
+      while (is_alpha(ch = input_getc(parser->input)))
         continue;
 
       if (unlikely(ch != EOF))
-        ungetc(ch, parser->file);
+        input_ungetc(parser->input);
 
       lex_return(TK_NULL);
     }
@@ -259,11 +580,19 @@ retry:
       return;
     case ' ':
     case '\t':
+      goto retry;
     case '\n':
+      parser->line_start = input_tell(parser->input);
       goto retry;
   }
 }
 
+static inline void next(struct parser *parser) {
+  PROFILE_ENTER(PHASE_LEX);
+  lex(parser);
+  PROFILE_EXIT();
+}
+
 static const char *token_desc[TK_NKIND] = {
   [TK_NUMBER] = "number",
   [TK_BOOL] = "bool",
@@ -291,86 +620,242 @@ static inline void lex_match(struct parser *parser, enum tokenkind expected) {
   next(parser);
 }
 
-static void skip_value(struct parser *parser);
+static inline void check_depth(struct parser *parser) {
+  if (unlikely(parser->ncontainer + parser->nframe >= parser->max_depth))
+    error(parser, "nesting depth exceeds %zu", parser->max_depth);
+}
 
-static void skip_object(struct parser *parser) {
-  assert(parser->kind == TK_LBRACE);
+static void *grow_stack(struct parser *parser, void *stack, size_t *capacity,
+                        size_t size) {
+  size_t new_capacity = *capacity ? *capacity * 2 : 64;
+  void *new_stack = realloc(stack, new_capacity * size);
+  if (unlikely(!new_stack))
+    error(parser, "out of memory");
 
-  next(parser);
-  while (parser->kind != TK_RBRACE) {
-    lex_match(parser, TK_STRING);
-    lex_match(parser, TK_COLON);
-    skip_value(parser);
-    if (parser->kind == TK_COMMA)
-      next(parser);
+  *capacity = new_capacity;
+  return new_stack;
+}
+
+static inline void push_container(struct parser *parser, enum tokenkind kind) {
+  check_depth(parser);
+
+  if (unlikely(parser->ncontainer == parser->container_capacity)) {
+    parser->containers =
+        grow_stack(parser, parser->containers, &parser->container_capacity,
+                   sizeof(*parser->containers));
   }
 
-  next(parser);
+  parser->containers[parser->ncontainer++] = kind;
 }
 
-static void skip_array(struct parser *parser) {
-  assert(parser->kind == TK_LBRACKET);
+static inline struct match_frame *push_frame(struct parser *parser,
+                                             struct match *match,
+                                             enum tokenkind kind) {
+  check_depth(parser);
 
+  if (unlikely(parser->nframe == parser->frame_capacity)) {
+    parser->frames = grow_stack(parser, parser->frames,
+                                &parser->frame_capacity,
+                                sizeof(*parser->frames));
+  }
+
+  struct match_frame *frame = &parser->frames[parser->nframe++];
+  frame->match = match;
+  frame->selector = NULL;
+  frame->index = 0;
+  frame->member = 0;
+  frame->comma = SIZE_MAX;
+  frame->kind = kind;
+  frame->speculated = false;
+  return frame;
+}
+
+static inline enum tokenkind closing_of(enum tokenkind kind) {
+  return kind == TK_LBRACE ? TK_RBRACE : TK_RBRACKET;
+}
+
+/* Skip the rest of the container just opened by next_item(), jumping over
+ * the payloads of strings and binaries. */
+static void skip_items(struct parser *parser) {
+  struct decoder *decoder = parser->decoder;
+  struct decoder_level *level = decoder_top(decoder);
+
+  if (unlikely(!decoder_skip(decoder, parser->input, level->remaining,
+                             level->indefinite)))
+    error(parser, "invalid or truncated item");
+
+  --decoder->nlevel;
   next(parser);
-  while (parser->kind != TK_RBRACKET) {
-    skip_value(parser);
-    if (parser->kind == TK_COMMA)
-      next(parser);
+}
+
+/* Return the structural index for a lookup at the current token, rebuilt
+ * over the buffered input once lookups pass its end. */
+static struct tape *tape_at_token(struct parser *parser) {
+  struct input *input = parser->input;
+  struct tape *tape = parser->tape;
+  size_t offset = input->token;
+
+  if (offset >= tape->limit) {
+    unsigned char *p = input_at(input, offset);
+    tape_build(tape, p, input->end - p, offset);
   }
+  return tape;
+}
+
+/* Skip the container starting at the current token by jumping to its
+ * closing bracket in the structural index. Returns false if the closing
+ * bracket is not known. */
+static bool tape_skip(struct parser *parser) {
+  struct input *input = parser->input;
+  struct tape *tape = tape_at_token(parser);
+  size_t offset = input->token;
+
+  size_t close = tape_find_close(tape, offset);
+  if (close == TAPE_NONE)
+    return false;
 
+  input->curr = input_at(input, close) + 1;
   next(parser);
+  return true;
 }
 
 static void skip_value(struct parser *parser) {
-  switch (parser->kind) {
-    case TK_LBRACE:
-      skip_object(parser);
-      return;
-    case TK_LBRACKET:
-      skip_array(parser);
-      return;
-    case TK_BOOL:
-    case TK_NULL:
-    case TK_NUMBER:
-    case TK_STRING:
-      next(parser);
+  size_t base = parser->ncontainer;
+
+  PROFILE_ENTER(PHASE_SKIP);
+
+  while (true) {
+    bool opened = false;
+
+    switch (parser->kind) {
+      case TK_LBRACE:
+      case TK_LBRACKET:
+        if (parser->decoder) {
+          skip_items(parser);
+          break;
+        }
+        if (parser->tape && tape_skip(parser))
+          break;
+        push_container(parser, parser->kind);
+        next(parser);
+        opened = true;
+        break;
+      case TK_BOOL:
+      case TK_NULL:
+      case TK_NUMBER:
+      case TK_STRING:
+        next(parser);
+        break;
+      default:
+        error(parser, "unexpected %s", token_desc[parser->kind]);
+    }
+
+    /* close finished containers and move to the next value */
+    while (true) {
+      if (parser->ncontainer == base) {
+        PROFILE_EXIT();
+        return;
+      }
+
+      enum tokenkind container = parser->containers[parser->ncontainer - 1];
+      if (!opened && parser->kind == TK_COMMA)
+        next(parser);
+      opened = false;
+
+      if (parser->kind == closing_of(container)) {
+        --parser->ncontainer;
+        next(parser);
+        continue;
+      }
+
+      if (container == TK_LBRACE) {
+        lex_match(parser, TK_STRING);
+        lex_match(parser, TK_COLON);
+      }
+      break;
+    }
+  }
+}
+
+/* Skip the rest of the member or element at the current token by jumping
+ * to the ',' or closing bracket after it in the structural index. Returns
+ * false if it is not known. */
+static bool tape_skip_member(struct parser *parser) {
+  struct input *input = parser->input;
+  struct tape *tape = tape_at_token(parser);
+
+  size_t end = tape_find_next(tape, input->token);
+  if (end == TAPE_NONE)
+    return false;
+
+  input->curr = input_at(input, end);
+  next(parser);
+  return true;
+}
+
+/* Skip an element of an array not selected. */
+static void skip_element(struct parser *parser) {
+  if (parser->tape && tape_skip_member(parser))
+    return;
+  skip_value(parser);
+}
+
+/* Skip the ':' and the value of a member not selected. With --input-format,
+ * the value is skipped in the input without lexing it. */
+static void skip_member_value(struct parser *parser) {
+  struct decoder *decoder = parser->decoder;
+  if (!decoder) {
+    expect(parser, TK_COLON);
+    if (parser->tape && tape_skip_member(parser))
       return;
-    default:
-      error(parser, "unexpected %s", token_desc[parser->kind]);
+    next(parser);
+    skip_value(parser);
+    return;
   }
+
+  expect(parser, TK_COLON);
+  if (unlikely(!decoder_skip(decoder, parser->input, 1, false)))
+    error(parser, "invalid or truncated item");
+
+  struct decoder_level *level = decoder_top(decoder);
+  if (!level->indefinite)
+    --level->remaining;
+  level->state = LEVEL_AFTER_ITEM;
+  level->key = true;
+  next(parser);
 }
 
 static inline void print_token(struct parser *parser) {
   switch (parser->kind) {
     case TK_COMMA:
-      fputc(',', stdout);
+      fputc(',', parser->out);
       break;
     case TK_COLON:
-      fputc(':', stdout);
+      fputc(':', parser->out);
       break;
     case TK_LBRACE:
-      fputc('{', stdout);
+      fputc('{', parser->out);
       break;
     case TK_RBRACE:
-      fputc('}', stdout);
+      fputc('}', parser->out);
       break;
     case TK_LBRACKET:
-      fputc('[', stdout);
+      fputc('[', parser->out);
       break;
     case TK_RBRACKET:
-      fputc(']', stdout);
+      fputc(']', parser->out);
       break;
     case TK_BOOL:
-      fputs(parser->attr.boolean ? "true" : "false", stdout);
+      fputs(parser->attr.boolean ? "true" : "false", parser->out);
       break;
     case TK_NULL:
-      fputs("null", stdout);
+      fputs("null", parser->out);
       break;
     case TK_NUMBER:
-      fwrite(parser->attr.number, 1, parser->length, stdout);
+      fwrite(parser->attr.number, 1, parser->length, parser->out);
       break;
     case TK_STRING:
-      fwrite(parser->attr.string, 1, parser->length, stdout);
+      fwrite(parser->attr.string, 1, parser->length, parser->out);
       break;
     case TK_EOF:
       error(parser, "unexpected %s", token_desc[parser->kind]);
@@ -389,36 +874,6 @@ static inline void print_and_next(struct parser *parser) {
   next(parser);
 }
 
-static void print_value(struct parser *parser);
-
-static void print_object(struct parser *parser) {
-  assert(parser->kind == TK_LBRACE);
-
-  print_and_next(parser);
-  while (parser->kind != TK_RBRACE) {
-    print_and_match(parser, TK_STRING);
-    print_and_match(parser, TK_COLON);
-    print_value(parser);
-    if (parser->kind == TK_COMMA)
-      print_and_next(parser);
-  }
-
-  print_and_next(parser);
-}
-
-static void print_array(struct parser *parser) {
-  assert(parser->kind == TK_LBRACKET);
-
-  print_and_next(parser);
-  while (parser->kind != TK_RBRACKET) {
-    print_value(parser);
-    if (parser->kind == TK_COMMA)
-      print_and_next(parser);
-  }
-
-  print_and_next(parser);
-}
-
 static inline char to_hex_digit(char ch) {
   if (ch <= 9)
     return '0' + ch;
@@ -426,223 +881,1554 @@ static inline char to_hex_digit(char ch) {
   return 'A' + (ch - 10);
 }
 
-static void print_escape(unsigned char ch) {
-  const char *s;
+/* Write the JSON escape of `ch` to `out`, which must have room for 6 bytes.
+ * Returns the end of the escape. */
+static unsigned char *write_escape(unsigned char *out, unsigned char ch) {
+  char letter;
   switch (ch) {
     case '\r':
-      s = "\\r";
+      letter = 'r';
       break;
     case '\f':
-      s = "\\f";
+      letter = 'f';
       break;
     case '\n':
-      s = "\\n";
+      letter = 'n';
       break;
     case '\t':
-      s = "\\t";
+      letter = 't';
       break;
     case '\b':
-      s = "\\b";
+      letter = 'b';
       break;
     case '"':
-      s = "\\\"";
-      break;
     case '\\':
-      s = "\\\\";
+      letter = ch;
       break;
-    default: {
-      fputs("\\u00", stdout);
-      fputc(to_hex_digit(ch >> 4), stdout);
-      fputc(to_hex_digit(ch & 15), stdout);
-      return;
+    default:
+      memcpy(out, "\\u00", 4);
+      out[4] = to_hex_digit(ch >> 4);
+      out[5] = to_hex_digit(ch & 15);
+      return out + 6;
+  }
+  out[0] = '\\';
+  out[1] = letter;
+  return out + 2;
+}
+
+static void print_escape(FILE *out, unsigned char ch) {
+  unsigned char escape[6];
+  fwrite(escape, 1, write_escape(escape, ch) - escape, out);
+}
+
+/* Write [s, s + length) quoted as by print_quoted() to `out`, which must
+ * have room for 6 * length + 2 bytes. Returns the end of what was written. */
+static unsigned char *write_quoted(unsigned char *out, const unsigned char *s,
+                                   size_t length) {
+  *out++ = '"';
+  for (size_t i = 0; i < length; ++i) {
+    if (is_cntrl(s[i]) || s[i] == '"' || s[i] == '\\') {
+      out = write_escape(out, s[i]);
+    } else {
+      *out++ = s[i];
     }
   }
-  fputs(s, stdout);
+  *out++ = '"';
+  return out;
 }
 
-static void print_string(struct parser *parser) {
-  unsigned char *s = parser->attr.string;
-  unsigned char *end = s + parser->length;
-  fputc('"', stdout);
+/* Print [s, s + length) as a quoted JSON string. */
+static void print_quoted(FILE *out, const unsigned char *s, size_t length) {
+  const unsigned char *end = s + length;
+  fputc('"', out);
 
   while (true) {
-    unsigned char *curr = s;
+    const unsigned char *curr = s;
     while (likely(!(curr == end || is_cntrl(*curr) || *curr == '"' || *curr == '\\')))
       ++curr;
 
-    fwrite(s, 1, curr - s, stdout);
+    fwrite(s, 1, curr - s, out);
 
     if (unlikely(curr == end))
       break;
 
-    print_escape(*curr);
+    print_escape(out, *curr);
     s = curr + 1;
   }
 
-  fputc('"', stdout);
-  next(parser);
+  fputc('"', out);
 }
 
-static void print_value(struct parser *parser) {
-  switch (parser->kind) {
-    case TK_LBRACE:
-      print_object(parser);
-      return;
-    case TK_LBRACKET:
-      print_array(parser);
-      return;
-    case TK_STRING:
-      print_string(parser);
-      return;
-    case TK_BOOL:
-    case TK_NULL:
-    case TK_NUMBER:
-      print_and_next(parser);
-      return;
-    default:
-      error(parser, "unexpected %s", token_desc[parser->kind]);
-  }
+static void print_string(struct parser *parser) {
+  PROFILE_ENTER(PHASE_PRINT_STRING);
+  load_string(parser);
+  print_quoted(parser->out, parser->attr.string, parser->length);
+  next(parser);
+  PROFILE_EXIT();
 }
 
-#define FOR_EACH_KEY(on_key)                                                   \
-  do {                                                                         \
-    assert(parser->kind == TK_LBRACE);                                         \
-    next(parser);                                                              \
-    while (parser->kind != TK_RBRACE) {                                        \
-      expect(parser, TK_STRING);                                               \
-      on_key;                                                                  \
-      if (parser->kind == TK_COMMA)                                            \
-        next(parser);                                                          \
-    }                                                                          \
-    next(parser);                                                              \
-  } while (0)
-
-#define FOR_EACH_ELEMENT(on_element)                                           \
-  do {                                                                         \
-    size_t index = 0;                                                          \
-    assert(parser->kind == TK_LBRACKET);                                       \
-    next(parser);                                                              \
-    while (parser->kind != TK_RBRACKET) {                                      \
-      on_element;                                                              \
-      ++index;                                                                 \
-      if (parser->kind == TK_COMMA)                                            \
-        next(parser);                                                          \
-    }                                                                          \
-    next(parser);                                                              \
-  } while (0)
+static void print_value(struct parser *parser) {
+  size_t base = parser->ncontainer;
 
-static void do_match(struct parser * parser, struct match *match);
+  while (true) {
+    bool opened = false;
+
+    switch (parser->kind) {
+      case TK_LBRACE:
+      case TK_LBRACKET:
+        push_container(parser, parser->kind);
+        print_and_next(parser);
+        opened = true;
+        break;
+      case TK_STRING:
+        print_string(parser);
+        break;
+      case TK_BOOL:
+      case TK_NULL:
+      case TK_NUMBER:
+        print_and_next(parser);
+        break;
+      default:
+        error(parser, "unexpected %s", token_desc[parser->kind]);
+    }
 
-static void match_on_object(struct parser *parser, struct match *match) {
-  assert(parser->kind == TK_LBRACE);
+    /* close finished containers and move to the next value */
+    while (true) {
+      if (parser->ncontainer == base)
+        return;
 
-  struct selector *end = match->selectors + match->nselector;
-  for (struct selector *p = match->selectors; p != end; ++p) {
-    if (can_match_key(p->type))
-      goto start;
-  }
+      enum tokenkind container = parser->containers[parser->ncontainer - 1];
+      if (!opened && parser->kind == TK_COMMA)
+        print_and_next(parser);
+      opened = false;
 
-  skip_value(parser);
-  return;
-
-start:
-  FOR_EACH_KEY({
-    for (struct selector *p = match->selectors; p != end; ++p) {
-      if (p->type != MATCH_ALL_KEY &&
-          (p->type != MATCH_KEY || parser->length != p->expected_keylen ||
-           memcmp(parser->attr.string, p->expected.key, parser->length)) != 0) {
+      if (parser->kind == closing_of(container)) {
+        --parser->ncontainer;
+        print_and_next(parser);
         continue;
       }
-      strpool_commit(parser->strpool, parser->length);
-      p->matched.key = parser->attr.string;
-      p->matched_keylen = parser->length;
-      next(parser);
-      lex_match(parser, TK_COLON);
-      do_match(parser, p->submatch);
-      strpool_free(parser->strpool, p->matched_keylen);
-      goto next_loop;
+
+      if (container == TK_LBRACE) {
+        expect(parser, TK_STRING);
+        print_string(parser);
+        print_and_match(parser, TK_COLON);
+      }
+      break;
     }
-    next(parser);
-    lex_match(parser, TK_COLON);
-    skip_value(parser);
-  next_loop:
-  });
+  }
 }
 
-static void match_on_array(struct parser *parser, struct match *match) {
-  assert(parser->kind == TK_LBRACKET);
+/* Transcode the current value into the binary encoding of --output-format,
+ * token by token. */
+static void encode_value(struct parser *parser) {
+  struct encoder *encoder = parser->encoder;
+  size_t base = parser->ncontainer;
 
-  struct selector *end = match->selectors + match->nselector;
-  for (struct selector *p = match->selectors; p != end; ++p) {
-    if (can_match_index(p->type))
-      goto start;
-  }
+  while (true) {
+    bool opened = false;
+
+    switch (parser->kind) {
+      case TK_LBRACE:
+        push_container(parser, parser->kind);
+        encoder_begin_map(encoder);
+        next(parser);
+        opened = true;
+        break;
+      case TK_LBRACKET:
+        push_container(parser, parser->kind);
+        encoder_begin_array(encoder);
+        next(parser);
+        opened = true;
+        break;
+      case TK_STRING:
+        load_string(parser);
+        encoder_string(encoder, parser->attr.string, parser->length);
+        next(parser);
+        break;
+      case TK_BOOL:
+        encoder_bool(encoder, parser->attr.boolean);
+        next(parser);
+        break;
+      case TK_NULL:
+        encoder_null(encoder);
+        next(parser);
+        break;
+      case TK_NUMBER:
+        encoder_number(encoder, parser->attr.number, parser->length);
+        next(parser);
+        break;
+      default:
+        error(parser, "unexpected %s", token_desc[parser->kind]);
+    }
 
-  skip_value(parser);
-  return;
+    /* close finished containers and move to the next value */
+    while (true) {
+      if (parser->ncontainer == base) {
+        encoder_flush(encoder, parser->out);
+        return;
+      }
 
-start:
-  FOR_EACH_ELEMENT({
-    for (struct selector *p = match->selectors; p != end; ++p) {
-      if (p->type != MATCH_ALL_INDEX &&
-          (p->type != MATCH_INDEX || index != p->expected.index)) {
+      enum tokenkind container = parser->containers[parser->ncontainer - 1];
+      if (!opened && parser->kind == TK_COMMA)
+        next(parser);
+      opened = false;
+
+      if (parser->kind == closing_of(container)) {
+        --parser->ncontainer;
+        encoder_end(encoder);
+        next(parser);
         continue;
       }
 
-      p->matched.index = index;
+      if (container == TK_LBRACE) {
+        expect(parser, TK_STRING);
+        encoder_string(encoder, parser->attr.string, parser->length);
+        next(parser);
+        lex_match(parser, TK_COLON);
+      }
+      break;
+    }
+  }
+}
 
-      do_match(parser, p->submatch);
+/* Remove all whitespace outside of strings from [p, end) in place and return
+ * the new end. Runs without whitespace or quotes are located by the
+ * vectorized scanner and moved in one piece. */
+static unsigned char *minify(unsigned char *p, unsigned char *end) {
+  unsigned char *out = p;
+
+  while (p != end) {
+    unsigned char *stop = simd_find_quote_or_space(p, end);
+
+    if (likely(stop != end) && *stop == '"') {
+      /* keep the string up to its closing quote */
+      while (true) {
+        stop = simd_find2(stop + 1, end, '"', '\\');
+        if (stop == end || *stop == '"')
+          break;
+        /* skip the escaped character */
+        if (++stop == end)
+          break;
+      }
 
-      goto next_loop;
+      if (stop != end)
+        ++stop;
     }
-    skip_value(parser);
-  next_loop:
-  });
-}
 
-static void do_match(struct parser *parser, struct match *match) {
-  if (!match) {
-    if ((parser->print_option & PRINT_RAW) && parser->kind == TK_STRING) {
-      fwrite(parser->attr.string, 1, parser->length, stdout);
-      next(parser);
+    memmove(out, p, stop - p);
+    out += stop - p;
+    p = stop;
+
+    while (p != end && *p <= ' ')
+      ++p;
+  }
+
+  return out;
+}
+
+/* Print the current value by copying its bytes from the input, instead of
+ * re-serializing it token by token. */
+static void print_span(struct parser *parser) {
+  struct input *input = parser->input;
+  size_t start = input->token;
+
+  input_mark(input, start);
+  skip_value(parser);
+
+  unsigned char *begin = input_at(input, start);
+  unsigned char *end = input_at(input, input->token);
+  while (end != begin && is_space(end[-1]))
+    --end;
+
+  if (parser->print_option & PRINT_MINIFY)
+    end = minify(begin, end);
+
+  fwrite(begin, 1, end - begin, parser->out);
+
+  input_unmark(input);
+}
+
+/* Take the first scalar matched by the partition key as the partition value
+ * of the record. */
+static void capture_partition_value(struct parser *parser) {
+  struct partition *partition = parser->partition;
+
+  if (!partition->has_value) {
+    switch (parser->kind) {
+      case TK_STRING:
+        load_string(parser);
+        partition_set_value(partition, parser->attr.string, parser->length);
+        break;
+      case TK_NUMBER:
+        partition_set_value(partition, parser->attr.number, parser->length);
+        break;
+      case TK_BOOL: {
+        const char *s = parser->attr.boolean ? "true" : "false";
+        partition_set_value(partition, (const unsigned char *)s, strlen(s));
+        break;
+      }
+      case TK_NULL:
+        partition_set_value(partition, (const unsigned char *)"null", 4);
+        break;
+      default:
+        break;
+    }
+  }
+
+  skip_value(parser);
+}
+
+/* A value to be read again after it was consumed. Its bytes are kept in the
+ * input buffer through a mark until rewind_to() or drop_rewind_point(). */
+struct rewind_point {
+  size_t offset;
+  size_t tape_base;
+  size_t tape_cursor;
+  struct decoder_state decoder;
+};
+
+static void save_rewind_point(struct parser *parser,
+                              struct rewind_point *point) {
+  struct tape *tape = parser->tape;
+
+  point->offset = parser->input->token;
+  point->tape_base = tape ? tape->base : 0;
+  point->tape_cursor = tape ? tape->cursor : 0;
+  point->decoder = parser->decoder ? parser->decoder->before
+                                   : (struct decoder_state) {};
+  input_mark(parser->input, point->offset);
+}
+
+static void drop_rewind_point(struct parser *parser) {
+  input_unmark(parser->input);
+}
+
+/* Go back to the value at `point` and lex its first token again. */
+static void rewind_to(struct parser *parser, struct rewind_point *point) {
+  struct tape *tape = parser->tape;
+
+  input_rewind(parser->input, point->offset);
+  input_unmark(parser->input);
+
+  /* tape lookups must not go backwards, so restore the cursor, or have the
+   * tape rebuilt if it was rebuilt past the value */
+  if (tape) {
+    if (tape->base == point->tape_base) {
+      tape->cursor = point->tape_cursor;
     } else {
-      print_value(parser);
+      tape->limit = 0;
     }
-    if (parser->print_option & PRINT_NULL_SEP) {
-      fputc('\0', stdout);
+  }
+
+  if (parser->decoder)
+    decoder_restore(parser->decoder, &point->decoder);
+
+  next(parser);
+}
+
+static unsigned char *reserve_scratch(struct parser *parser, size_t size) {
+  if (unlikely(size > parser->scratch_capacity)) {
+    size_t capacity = parser->scratch_capacity ? parser->scratch_capacity : 64;
+    while (capacity < size)
+      capacity *= 2;
+
+    unsigned char *scratch = realloc(parser->scratch, capacity);
+    if (unlikely(!scratch))
+      out_of_memory();
+
+    parser->scratch = scratch;
+    parser->scratch_capacity = capacity;
+  }
+
+  return parser->scratch;
+}
+
+/* Rewrite the strings in the minified source [p, end) in place with their
+ * escapes decoded, except for '"', '\\' and control characters which are
+ * escaped as by print_quoted(), so that equal strings are spelled the same
+ * however they were escaped. Returns the new end, which is never past the
+ * old one. */
+static unsigned char *canonicalize_strings(unsigned char *p,
+                                           unsigned char *end) {
+  unsigned char *out = p;
+  bool in_string = false;
+
+  while (p != end) {
+    unsigned char ch = *p++;
+    if (ch == '"') {
+      in_string = !in_string;
+    } else if (in_string && ch == '\\' && p != end) {
+      unsigned char *escape = p - 1;
+      unsigned long codepoint = simple_escape(*p++);
+      if (p[-1] == 'u') {
+        codepoint = end - p >= 4 ? decode_hex4(p) : 0x10000;
+        if (codepoint > 0xFFFF) {
+          /* not a valid escape, keep it as it is */
+          *out++ = '\\';
+          *out++ = 'u';
+          continue;
+        }
+        p += 4;
+
+        if (codepoint >= 0xD800 && codepoint <= 0xDFFF) {
+          unsigned long low = end - p >= 6 && p[0] == '\\' && p[1] == 'u'
+                                  ? decode_hex4(p + 2)
+                                  : 0;
+          if (codepoint <= 0xDBFF && low >= 0xDC00 && low <= 0xDFFF) {
+            codepoint =
+                0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+            p += 6;
+          } else {
+            codepoint = REPLACEMENT_CHARACTER;
+          }
+        }
+      }
+
+      /* JSON needs them escaped, but the lenient escapes like \a are too
+       * short to be rewritten as \u0007, which only matters for invalid
+       * input */
+      if (codepoint == '"' || codepoint == '\\' ||
+          (codepoint < 0x20 && (p - escape == 6 || codepoint == '\b' ||
+                                codepoint == '\f' || codepoint == '\n' ||
+                                codepoint == '\r' || codepoint == '\t'))) {
+        out = write_escape(out, codepoint);
+      } else {
+        encode_utf8(codepoint, out);
+        out += encode_utf8_len(codepoint);
+      }
+      continue;
+    }
+
+    *out++ = ch;
+  }
+
+  return out;
+}
+
+/* Consume the current value and store a key identifying it in the scratch
+ * buffer: its token kind, then the decoded string, the number literal, or
+ * the minified source of a container with canonical string escapes, or its
+ * bytes with --input-format. The start of the value must be marked. Returns
+ * the length of the key. */
+static size_t read_value_key(struct parser *parser) {
+  struct input *input = parser->input;
+  const unsigned char *value;
+  size_t length;
+
+  switch (parser->kind) {
+    case TK_STRING:
+      load_string(parser);
+      value = parser->attr.string;
+      length = parser->length;
+      break;
+    case TK_NUMBER:
+      value = parser->attr.number;
+      length = parser->length;
+      break;
+    case TK_BOOL:
+      value = (const unsigned char *)(parser->attr.boolean ? "true" : "false");
+      length = parser->attr.boolean ? 4 : 5;
+      break;
+    case TK_NULL:
+      value = (const unsigned char *)"null";
+      length = 4;
+      break;
+    case TK_LBRACE:
+    case TK_LBRACKET: {
+      enum tokenkind kind = parser->kind;
+      size_t start = input->token;
+      skip_value(parser);
+
+      unsigned char *begin = input_at(input, start);
+      unsigned char *end = input_at(input, input->token);
+      while (!parser->decoder && end != begin && is_space(end[-1]))
+        --end;
+
+      unsigned char *key = reserve_scratch(parser, 1 + (end - begin));
+      key[0] = kind;
+      memcpy(key + 1, begin, end - begin);
+      if (parser->decoder)
+        return 1 + (end - begin);
+
+      unsigned char *key_end = minify(key + 1, key + 1 + (end - begin));
+      if (memchr(key + 1, '\\', key_end - (key + 1)))
+        key_end = canonicalize_strings(key + 1, key_end);
+      return key_end - key;
+    }
+    default:
+      error(parser, "unexpected %s", token_desc[parser->kind]);
+  }
+
+  unsigned char *key = reserve_scratch(parser, 1 + length);
+  key[0] = parser->kind;
+  memcpy(key + 1, value, length);
+  next(parser);
+  return 1 + length;
+}
+
+/* For --unique: consume the current value if an equal one was matched
+ * before, otherwise remember it and leave it to be printed. */
+static bool first_occurrence(struct parser *parser) {
+  struct rewind_point point;
+
+  save_rewind_point(parser, &point);
+  size_t length = read_value_key(parser);
+  if (!value_set_insert(parser->unique, parser->scratch, length)) {
+    drop_rewind_point(parser);
+    return false;
+  }
+
+  rewind_to(parser, &point);
+  return true;
+}
+
+/* For --count-distinct: consume the current value and add it to the
+ * sketch. */
+static void count_distinct(struct parser *parser) {
+  struct input *input = parser->input;
+
+  input_mark(input, input->token);
+  size_t length = read_value_key(parser);
+  input_unmark(input);
+
+  hll_add(parser->distinct, hash_bytes(parser->scratch, length));
+}
+
+/* For --group-by: the first root selector yields the key of the record,
+ * the others yield numbers to aggregate. Matches of the key after the first
+ * and non-numbers are ignored. */
+static void group_match(struct parser *parser) {
+  struct group_table *groups = parser->groups;
+
+  /* the selector of {KEY,VALUE...} the match came through, which may be
+   * under a path as in .a{.k,.v} */
+  size_t index = 0;
+  for (size_t i = 0; i < parser->nframe; ++i) {
+    struct match_frame *frame = &parser->frames[i];
+    if (frame->match && frame->match->nselector > 1) {
+      index = frame->selector - frame->match->selectors;
+      break;
+    }
+  }
+
+  if (index == 0) {
+    /* compared as decoded, and kept as JSON for printing */
+    input_mark(parser->input, parser->input->token);
+    size_t length = read_value_key(parser);
+    input_unmark(parser->input);
+    unsigned char *key = parser->scratch + 1;
+    if (parser->scratch[0] == TK_STRING) {
+      unsigned char *scratch = reserve_scratch(parser, 7 * length + 2);
+      key = scratch + length;
+      length = write_quoted(key, scratch + 1, length - 1) - key;
     } else {
-      fputs(parser->delimiter, stdout);
+      --length;
+    }
+    group_table_set_key(groups, key, length);
+  } else if (parser->kind == TK_NUMBER) {
+    unsigned char *number = reserve_scratch(parser, parser->length + 1);
+    memcpy(number, parser->attr.number, parser->length);
+    number[parser->length] = '\0';
+    group_table_add_value(groups, index - 1, strtod((char *)number, NULL));
+    next(parser);
+  } else {
+    skip_value(parser);
+  }
+}
+
+/* For --top: take the first number matched in the record as its rank. */
+static void top_match(struct parser *parser) {
+  struct top *top = parser->top;
+
+  if (top->has_number || parser->kind != TK_NUMBER) {
+    skip_value(parser);
+    return;
+  }
+
+  unsigned char *number = reserve_scratch(parser, parser->length + 1);
+  memcpy(number, parser->attr.number, parser->length);
+  number[parser->length] = '\0';
+  top->number = strtod((char *)number, NULL);
+  top->has_number = true;
+  next(parser);
+}
+
+/* For --in-set: note whether a matched ID is a member, without copying
+ * it. */
+static void test_membership(struct parser *parser) {
+  struct id_set *set = parser->in_set;
+
+  if (!set->found) {
+    if (parser->kind == TK_STRING) {
+      load_string(parser);
+      set->found = id_set_contains(set, parser->attr.string, parser->length);
+    } else if (parser->kind == TK_NUMBER) {
+      set->found = id_set_contains(set, parser->attr.number, parser->length);
     }
+  }
+
+  skip_value(parser);
+}
+
+static struct projection_level *push_level(struct parser *parser,
+                                           enum tokenkind kind) {
+  struct projection *projection = parser->projection;
+
+  if (unlikely(projection->nlevel == projection->level_capacity)) {
+    projection->levels =
+        grow_stack(parser, projection->levels, &projection->level_capacity,
+                   sizeof(*projection->levels));
+  }
+
+  struct projection_level *level = &projection->levels[projection->nlevel++];
+  *level = (struct projection_level) {
+    .kind = kind,
+    .nonempty = false,
+    .index = 0,
+    .key = projection->keys_length,
+    .keylen = 0,
+  };
+  return level;
+}
+
+/* Whether output level `level` is the container entered through the current
+ * member of `frame`. */
+static bool is_level_of(struct projection *projection,
+                        struct projection_level *level,
+                        struct match_frame *frame, enum tokenkind kind) {
+  if (level->kind != kind)
+    return false;
 
-    if (parser->print_option & PRINT_FLUSH_STDOUT)
-      fflush(stdout);
+  if (frame->kind == TK_LBRACKET)
+    return level->index == frame->index;
 
+  return level->keylen == frame->selector->matched_keylen &&
+         memcmp(projection->keys + level->key, frame->selector->matched.key,
+                level->keylen) == 0;
+}
+
+/* Start a member of `level` for the current member of `frame`. */
+static void print_member(struct parser *parser, struct projection_level *level,
+                         struct match_frame *frame) {
+  if (level->nonempty)
+    fputc(',', parser->out);
+  level->nonempty = true;
+
+  if (level->kind == TK_LBRACE) {
+    print_quoted(parser->out, frame->selector->matched.key,
+                 frame->selector->matched_keylen);
+    fputc(':', parser->out);
+  }
+}
+
+static void close_levels(struct parser *parser, size_t nlevel) {
+  struct projection *projection = parser->projection;
+
+  while (projection->nlevel > nlevel) {
+    struct projection_level *level =
+        &projection->levels[--projection->nlevel];
+    fputc(level->kind == TK_LBRACE ? '}' : ']', parser->out);
+    projection->keys_length = level->key;
+  }
+}
+
+/* For PRINT_PROJECT: print the match inside the containers on its path,
+ * reusing the ones still open from the previous match. Level i of the
+ * output stands for frame i of the input. */
+static void project_match(struct parser *parser) {
+  struct projection *projection = parser->projection;
+  struct match_frame *frames = parser->frames;
+  size_t depth = parser->nframe;
+
+  if (depth == 0) {
+    print_span(parser);
     return;
   }
 
-  switch (parser->kind) {
-    case TK_LBRACE: {
-      match_on_object(parser, match);
-      return;
+  size_t common = 1;
+  while (common < projection->nlevel && common < depth &&
+         is_level_of(projection, &projection->levels[common],
+                     &frames[common - 1], frames[common].kind))
+    ++common;
+  close_levels(parser, common);
+
+  for (size_t i = common; i < depth; ++i) {
+    struct match_frame *parent = &frames[i - 1];
+    print_member(parser, &projection->levels[i - 1], parent);
+    fputc(frames[i].kind == TK_LBRACE ? '{' : '[', parser->out);
+
+    struct projection_level *level = push_level(parser, frames[i].kind);
+    if (parent->kind == TK_LBRACKET) {
+      level->index = parent->index;
+    } else {
+      size_t keylen = parent->selector->matched_keylen;
+      if (unlikely(projection->keys_length + keylen >
+                   projection->keys_capacity)) {
+        size_t capacity = max(projection->keys_length + keylen,
+                              2 * projection->keys_capacity);
+        unsigned char *keys = realloc(projection->keys, capacity);
+        if (unlikely(!keys))
+          out_of_memory();
+        projection->keys = keys;
+        projection->keys_capacity = capacity;
+      }
+
+      memcpy(projection->keys + projection->keys_length,
+             parent->selector->matched.key, keylen);
+      projection->keys_length += keylen;
+      level->keylen = keylen;
     }
-    case TK_LBRACKET: {
-      match_on_array(parser, match);
-      return;
+  }
+
+  print_member(parser, &projection->levels[depth - 1], &frames[depth - 1]);
+  print_span(parser);
+}
+
+/* Stream offset just past the value that started at `start`, once it was
+ * consumed. */
+static size_t value_end(struct parser *parser, size_t start) {
+  struct input *input = parser->input;
+  unsigned char *begin = input_at(input, start);
+  unsigned char *end = input_at(input, input->token);
+  while (end != begin && is_space(end[-1]))
+    --end;
+
+  return start + (end - begin);
+}
+
+/* Move the redaction cursor to stream offset `offset`, keeping the input
+ * from there on. */
+static void set_cursor(struct parser *parser, size_t offset) {
+  parser->redaction->cursor = offset;
+  input_mark(parser->input, offset);
+}
+
+/* Print the input from the redaction cursor up to stream offset `offset`. */
+static void copy_through(struct parser *parser, size_t offset) {
+  struct redaction *redaction = parser->redaction;
+
+  if (redaction->trim) {
+    unsigned char *p = input_at(parser->input, redaction->cursor);
+    while (redaction->cursor < offset && is_space(*p)) {
+      ++redaction->cursor;
+      ++p;
+    }
+    redaction->trim = false;
+  }
+
+  if (offset > redaction->cursor) {
+    fwrite(input_at(parser->input, redaction->cursor), 1,
+           offset - redaction->cursor, parser->out);
+    set_cursor(parser, offset);
+  }
+}
+
+/* For --mask and --delete: replace the match with the mask, or drop it. A
+ * dropped member takes the comma before it along, or the comma after it if
+ * everything before it in its container was dropped too. */
+static void redact_match(struct parser *parser) {
+  struct redaction *redaction = parser->redaction;
+  struct input *input = parser->input;
+  size_t start = input->token;
+
+  if (redaction->mask || parser->nframe == 0) {
+    copy_through(parser, start);
+    if (redaction->mask) {
+      fputs(redaction->mask, parser->out);
+    } else {
+      redaction->dropped = true;
+    }
+    skip_value(parser);
+    set_cursor(parser, value_end(parser, start));
+    return;
+  }
+
+  struct match_frame *frame = &parser->frames[parser->nframe - 1];
+  bool first = frame->comma == SIZE_MAX || frame->comma < redaction->cursor;
+  copy_through(parser, first ? frame->member : frame->comma);
+  skip_value(parser);
+
+  if (first && parser->kind == TK_COMMA) {
+    set_cursor(parser, input->token + 1);
+    redaction->trim = true;
+  } else {
+    set_cursor(parser, value_end(parser, start));
+  }
+}
+
+/* Start printing one value. With framing, it is printed into a buffer and
+ * labeled with the root selector and the member it matched. */
+static void begin_output(struct parser *parser) {
+  struct framing *framing = parser->framing;
+  if (!framing)
+    return;
+
+  framing->target = parser->out;
+  parser->out = framing->buffer;
+
+  framing->selector = 0;
+  framing->label = FRAME_LABEL_NONE;
+  if (parser->nframe == 0)
+    return;
+
+  struct match_frame *root = &parser->frames[0];
+  if (root->match)
+    framing->selector = root->selector - root->match->selectors;
+
+  struct match_frame *frame = &parser->frames[parser->nframe - 1];
+  if (frame->kind == TK_LBRACE) {
+    framing->label = FRAME_LABEL_KEY;
+    framing->key = frame->selector->matched.key;
+    framing->keylen = frame->selector->matched_keylen;
+  } else {
+    framing->label = FRAME_LABEL_INDEX;
+    framing->index = frame->index;
+  }
+}
+
+/* Drop the value begun with begin_output() without printing anything. */
+static void cancel_output(struct parser *parser) {
+  struct framing *framing = parser->framing;
+  if (!framing)
+    return;
+
+  parser->out = framing->target;
+  fseeko(framing->buffer, 0, SEEK_SET);
+}
+
+/* End one printed value: write the delimiter, or the frame, and count it
+ * against the limit. */
+static void finish_output(struct parser *parser) {
+  if (parser->framing) {
+    parser->out = parser->framing->target;
+    framing_write(parser->framing, parser->out);
+  } else if (parser->encoder) {
+    /* binary values delimit themselves */
+  } else if (parser->print_option & PRINT_NULL_SEP) {
+    fputc('\0', parser->out);
+  } else {
+    fputs(parser->delimiter, parser->out);
+  }
+
+  if (parser->print_option & PRINT_FLUSH_STDOUT)
+    flush_policy_wrote(parser->flush);
+
+  --parser->limit;
+}
+
+static void print_match(struct parser *parser) {
+  if (unlikely(parser->partition && parser->partition->capturing)) {
+    capture_partition_value(parser);
+    return;
+  }
+
+  if (unlikely(parser->in_set && parser->in_set->testing)) {
+    test_membership(parser);
+    return;
+  }
+
+  if (parser->redaction) {
+    redact_match(parser);
+    return;
+  }
+
+  if (parser->distinct) {
+    count_distinct(parser);
+    return;
+  }
+
+  if (parser->groups) {
+    group_match(parser);
+    return;
+  }
+
+  if (parser->top) {
+    top_match(parser);
+    return;
+  }
+
+  if (parser->unique && !first_occurrence(parser))
+    return;
+
+  if (parser->print_option & PRINT_PROJECT) {
+    project_match(parser);
+    return;
+  }
+
+  begin_output(parser);
+  if ((parser->print_option & PRINT_RAW) && parser->kind == TK_STRING) {
+    load_string(parser);
+    fwrite(parser->attr.string, 1, parser->length, parser->out);
+    next(parser);
+  } else if (parser->print_option & PRINT_PASSTHROUGH) {
+    print_span(parser);
+  } else if (parser->encoder) {
+    encode_value(parser);
+  } else {
+    print_value(parser);
+  }
+
+  finish_output(parser);
+}
+
+static bool has_key_selector(struct match *match) {
+  struct selector *end = match->selectors + match->nselector;
+  for (struct selector *p = match->selectors; p != end; ++p) {
+    if (can_match_key(p->type))
+      return true;
+  }
+  return false;
+}
+
+static bool has_index_selector(struct match *match) {
+  struct selector *end = match->selectors + match->nselector;
+  for (struct selector *p = match->selectors; p != end; ++p) {
+    if (can_match_index(p->type))
+      return true;
+  }
+  return false;
+}
+
+static struct selector *find_key_selector(struct parser *parser,
+                                          struct match *match) {
+  struct selector *end = match->selectors + match->nselector;
+  for (struct selector *p = match->selectors; p != end; ++p) {
+    if (p->type == MATCH_ALL_KEY ||
+        (p->type == MATCH_KEY && parser->length == p->expected_keylen &&
+         memcmp(parser->attr.string, p->expected.key, parser->length) == 0) ||
+        (p->type == MATCH_PATTERN &&
+         dfa_matches(p->expected.dfa, parser->attr.string, parser->length)))
+      return p;
+  }
+  return NULL;
+}
+
+static struct selector *find_index_selector(struct match *match, size_t index) {
+  struct selector *end = match->selectors + match->nselector;
+  for (struct selector *p = match->selectors; p != end; ++p) {
+    if (p->type == MATCH_ALL_INDEX ||
+        (p->type == MATCH_INDEX && p->expected.index == index))
+      return p;
+  }
+  return NULL;
+}
+
+/* Match the current value against `match`. Containers being matched are kept
+ * on the frame stack instead of recursing, and each loop iteration starts on
+ * a value that has to be matched against `match`. */
+static void do_match(struct parser *parser, struct match *match) {
+  size_t base = parser->nframe;
+
+  while (true) {
+    bool opened = false;
+
+    if (!match) {
+      print_match(parser);
+      if (unlikely(parser->limit == 0)) {
+        parser->nframe = base;
+        return;
+      }
+    } else if (parser->kind == TK_LBRACE && has_key_selector(match)) {
+      push_frame(parser, match, TK_LBRACE);
+      next(parser);
+      opened = true;
+    } else if (parser->kind == TK_LBRACKET && has_index_selector(match)) {
+      push_frame(parser, match, TK_LBRACKET);
+      next(parser);
+      opened = true;
+    } else {
+      skip_value(parser);
     }
-    default: {
+
+    /* finish the member just matched and find the next one to match */
+    while (true) {
+      if (parser->nframe == base)
+        return;
+
+      struct match_frame *frame = &parser->frames[parser->nframe - 1];
+      if (!opened) {
+        if (frame->selector && frame->kind == TK_LBRACE)
+          strpool_free(parser->strpool, frame->selector->matched_keylen);
+        frame->selector = NULL;
+        ++frame->index;
+        if (parser->kind == TK_COMMA) {
+          frame->comma = parser->input->token;
+          next(parser);
+        }
+      }
+      opened = false;
+
+      if (parser->kind == closing_of(frame->kind)) {
+        --parser->nframe;
+        next(parser);
+        continue;
+      }
+
+      frame->member = parser->input->token;
+
+      if (frame->kind == TK_LBRACE) {
+        expect(parser, TK_STRING);
+        struct selector *p = find_key_selector(parser, frame->match);
+        if (p) {
+          strpool_commit(parser->strpool, parser->length);
+          p->matched.key = parser->attr.string;
+          p->matched_keylen = parser->length;
+          frame->selector = p;
+        }
+        next(parser);
+        if (!p) {
+          skip_member_value(parser);
+          continue;
+        }
+        lex_match(parser, TK_COLON);
+        match = p->submatch;
+      } else {
+        struct selector *p = find_index_selector(frame->match, frame->index);
+        if (!p) {
+          skip_element(parser);
+          continue;
+        }
+        p->matched.index = frame->index;
+        frame->selector = p;
+        match = p->submatch;
+      }
+      break;
+    }
+  }
+}
+
+/* Scan the rest of the current container without lexing it, passing at most
+ * `count` commas at its level. Stops after the last of them, or on the
+ * closing bracket of the container, or at EOF, and returns the number of
+ * commas passed. The offset of the last one is stored in `comma`. */
+static size_t scan_commas(struct parser *parser, size_t count, size_t *comma) {
+  struct input *input = parser->input;
+  size_t depth = 0;
+  size_t passed = 0;
+
+  while (passed < count && input_fill(input)) {
+    switch (*input->curr++) {
+      case '"':
+        /* to the closing quote, over escaped characters */
+        while (true) {
+          unsigned char *stop = simd_find2(input->curr, input->end, '"', '\\');
+          input->curr = stop;
+          if (stop == input->end) {
+            if (!input_fill(input))
+              return passed;
+            continue;
+          }
+
+          ++input->curr;
+          if (*stop == '"')
+            break;
+          if (!input_fill(input))
+            return passed;
+          ++input->curr;
+        }
+        break;
+      case '{':
+      case '[':
+        ++depth;
+        break;
+      case '}':
+      case ']':
+        if (depth == 0) {
+          --input->curr;
+          return passed;
+        }
+        --depth;
+        break;
+      case ',':
+        if (depth == 0) {
+          ++passed;
+          *comma = input_tell(input) - 1;
+        }
+        break;
+      case '\n':
+        parser->line_start = input_tell(parser->input);
+        break;
+    }
+  }
+
+  return passed;
+}
+
+/* With an object just opened at chain step `step`, jump to the member its
+ * key was predicted at, instead of lexing the members before it. Returns
+ * true if the key there is the expected one, with it as the current token.
+ * Otherwise the input is back right after the '{'. Keys are assumed to be
+ * unique, as the members skipped are not looked at. */
+static bool speculate_member(struct parser *parser, struct step *step) {
+  struct input *input = parser->input;
+  struct match_frame *frame = &parser->frames[parser->nframe - 1];
+  size_t member = step->predicted_member;
+
+  if (step->confidence < 2)
+    return false;
+
+  /* keep the members skipped buffered, under any mark set already */
+  size_t start = input_tell(input);
+  size_t mark = input->mark;
+  size_t line_start = parser->line_start;
+  input_mark(input, min(mark, start));
+
+  size_t comma = SIZE_MAX;
+  if (scan_commas(parser, member, &comma) == member) {
+    next(parser);
+    if (parser->kind == TK_STRING && parser->length == step->expected_keylen &&
+        memcmp(parser->attr.string, step->expected.key, parser->length) == 0) {
+      input->mark = mark;
+      frame->index = member;
+      frame->comma = comma;
+      frame->speculated = true;
+      return true;
+    }
+  }
+
+  input_rewind(input, start);
+  input->mark = mark;
+  parser->line_start = line_start;
+  step->confidence = 0;
+  return false;
+}
+
+/* Learn the member index a key of a chain step was found at. */
+static inline void learn_member(struct step *step, size_t index) {
+  if (step->predicted_member == index) {
+    step->confidence += step->confidence < 2;
+  } else {
+    step->predicted_member = index;
+    step->confidence = 0;
+  }
+}
+
+/* do_match() specialized for a linear chain: the step for the value at frame
+ * depth d is steps[d], so there are no selector lists to scan. */
+static void do_match_chain(struct parser *parser, struct chain *chain) {
+  size_t base = parser->nframe;
+  struct step *step = chain->steps;
+  struct step *end = step + chain->nstep;
+
+  while (true) {
+    bool opened = false;
+
+    if (step == end) {
+      print_match(parser);
+      if (unlikely(parser->limit == 0)) {
+        parser->nframe = base;
+        return;
+      }
+    } else if (parser->kind == TK_LBRACE && can_match_key(step->type)) {
+      push_frame(parser, NULL, TK_LBRACE);
+      if (!parser->speculate || step->type != MATCH_KEY ||
+          !speculate_member(parser, step))
+        next(parser);
+      opened = true;
+    } else if (parser->kind == TK_LBRACKET && can_match_index(step->type)) {
+      push_frame(parser, NULL, TK_LBRACKET);
+      next(parser);
+      opened = true;
+    } else {
       skip_value(parser);
-      return;
     }
+
+    while (true) {
+      if (parser->nframe == base)
+        return;
+
+      struct match_frame *frame = &parser->frames[parser->nframe - 1];
+      step = &chain->steps[parser->nframe - 1 - base];
+      if (!opened) {
+        if (frame->selector && frame->kind == TK_LBRACE)
+          strpool_free(parser->strpool, frame->selector->matched_keylen);
+        frame->selector = NULL;
+        ++frame->index;
+        if (parser->kind == TK_COMMA && frame->speculated) {
+          /* the rest of the object cannot hold the key again */
+          scan_commas(parser, SIZE_MAX, &frame->comma);
+          next(parser);
+        } else if (parser->kind == TK_COMMA) {
+          frame->comma = parser->input->token;
+          next(parser);
+        }
+      }
+      opened = false;
+
+      if (parser->kind == closing_of(frame->kind)) {
+        --parser->nframe;
+        next(parser);
+        continue;
+      }
+
+      frame->member = parser->input->token;
+
+      if (frame->kind == TK_LBRACE) {
+        expect(parser, TK_STRING);
+        bool matched;
+        if (step->type == MATCH_PATTERN) {
+          matched = dfa_matches(step->expected.dfa, parser->attr.string,
+                                parser->length);
+        } else {
+          matched = step->type == MATCH_ALL_KEY ||
+                    (parser->length == step->expected_keylen &&
+                     memcmp(parser->attr.string, step->expected.key,
+                            parser->length) == 0);
+        }
+        if (matched) {
+          if (parser->speculate && step->type == MATCH_KEY &&
+              !frame->speculated)
+            learn_member(step, frame->index);
+          strpool_commit(parser->strpool, parser->length);
+          step->selector->matched.key = parser->attr.string;
+          step->selector->matched_keylen = parser->length;
+          frame->selector = step->selector;
+        }
+        next(parser);
+        if (!matched) {
+          skip_member_value(parser);
+          continue;
+        }
+        lex_match(parser, TK_COLON);
+      } else {
+        if (step->type == MATCH_INDEX && frame->index != step->expected.index) {
+          skip_element(parser);
+          continue;
+        }
+        step->selector->matched.index = frame->index;
+        frame->selector = step->selector;
+      }
+      ++step;
+      break;
+    }
+  }
+}
+
+void parser_destroy(struct parser *parser) {
+  if (parser->projection) {
+    free(parser->projection->levels);
+    free(parser->projection->keys);
+  }
+  free(parser->containers);
+  free(parser->frames);
+  free(parser->scratch);
+}
+
+static void match_value(struct parser *parser, struct match *match) {
+  if (match && match->chain) {
+    do_match_chain(parser, match->chain);
+  } else {
+    do_match(parser, match);
+  }
+}
+
+/* For PRINT_PROJECT: print all matches of the current value as one value
+ * shaped like it. */
+static void match_projected(struct parser *parser, struct match *match) {
+  struct projection *projection = parser->projection;
+  bool container = parser->kind == TK_LBRACE || parser->kind == TK_LBRACKET;
+
+  projection->nlevel = 0;
+  projection->keys_length = 0;
+
+  if (match && !container) {
+    /* nothing in a scalar can be selected */
+    skip_value(parser);
+    return;
+  }
+
+  begin_output(parser);
+  if (match) {
+    fputc(parser->kind == TK_LBRACE ? '{' : '[', parser->out);
+    push_level(parser, parser->kind);
+  }
+
+  match_value(parser, match);
+  close_levels(parser, 0);
+
+  finish_output(parser);
+}
+
+/* For --mask and --delete: print the current value with its matches
+ * rewritten, copying everything else from the input as is. */
+static void match_redacted(struct parser *parser, struct match *match) {
+  struct redaction *redaction = parser->redaction;
+  struct input *input = parser->input;
+  size_t start = input->token;
+
+  redaction->trim = false;
+  redaction->dropped = false;
+  begin_output(parser);
+  set_cursor(parser, start);
+  match_value(parser, match);
+  copy_through(parser, value_end(parser, redaction->cursor));
+  input_unmark(input);
+
+  if (redaction->dropped) {
+    cancel_output(parser);
+  } else {
+    finish_output(parser);
+  }
+}
+
+/* Match the current value for output. */
+static void match_output(struct parser *parser, struct match *match) {
+  if (parser->print_option & PRINT_PROJECT) {
+    match_projected(parser, match);
+  } else if (parser->redaction) {
+    match_redacted(parser, match);
+  } else {
+    match_value(parser, match);
+  }
+}
+
+/* Match the current value twice: first against the partition key to find
+ * the output file, then, after rewinding the input to the start of the
+ * value, against `match` to print into that file. Values without a
+ * partition value are printed to stdout. */
+static void match_partitioned(struct parser *parser, struct match *match) {
+  struct partition *partition = parser->partition;
+  struct rewind_point point;
+
+  save_rewind_point(parser, &point);
+  partition->has_value = false;
+  partition->capturing = true;
+  match_value(parser, partition->key);
+  partition->capturing = false;
+  rewind_to(parser, &point);
+
+  FILE *out = partition->has_value ? partition_file(partition) : stdout;
+  if (parser->resync) {
+    /* staged, and written to `out` once the record is complete */
+    parser->resync->target = out;
+    match_output(parser, match);
+  } else {
+    parser->out = out;
+    match_output(parser, match);
+    parser->out = stdout;
   }
 }
 
+/* Match the current value against the --in-set key. Returns true if a
+ * member was found, after rewinding to the start of the value so that it
+ * can be matched for output. Otherwise the value is consumed. */
+static bool match_in_set(struct parser *parser) {
+  struct id_set *set = parser->in_set;
+  struct rewind_point point;
+
+  save_rewind_point(parser, &point);
+  set->found = false;
+  set->testing = true;
+  match_value(parser, set->key);
+  set->testing = false;
+
+  if (!set->found) {
+    drop_rewind_point(parser);
+    return false;
+  }
+
+  rewind_to(parser, &point);
+  return true;
+}
+
+/* Match the current value to find its rank, and keep its source if it is
+ * among the top ones so far. The source stays buffered through a mark while
+ * matching, and is only copied once the rank was compared. */
+static void match_top(struct parser *parser, struct match *match) {
+  struct input *input = parser->input;
+  struct top *top = parser->top;
+  size_t start = input->token;
+
+  input_mark(input, start);
+  top->has_number = false;
+  match_value(parser, match);
+
+  if (top->has_number && top_admits(top, top->number)) {
+    unsigned char *begin = input_at(input, start);
+    unsigned char *end = input_at(input, input->token);
+    while (end != begin && is_space(end[-1]))
+      --end;
+
+    top_insert(top, top->number, begin, end - begin);
+  }
+
+  input_unmark(input);
+}
+
+/* In follow mode, the end of the file between values is reported as
+ * TK_EOF once everything before it was processed. Wait there for more
+ * values, until the process is asked to stop. */
+static void follow_next_value(struct parser *parser) {
+  while (parser->kind == TK_EOF && follow_wait(parser->follow, parser->input))
+    next(parser);
+}
+
 void start_matching(struct parser *parser, struct match *match) {
   next(parser);
-  do_match(parser, match);
+  if (parser->follow)
+    follow_next_value(parser);
+  match_output(parser, match);
 }
 
-void start_stream_matching(struct parser *parser, struct match *match) {
+/* Skip the rest of the current record and all following records the
+ * sampler does not take, by scanning for newlines without lexing. Stops on
+ * the first token of the next record taken. */
+static void skip_unsampled(struct parser *parser) {
+  do {
+    if (!input_skip_line(parser->input))
+      break;
+    parser->line_start = input_tell(parser->input);
+  } while (!sampler_take(parser->sampler) &&
+           parser->line_start < parser->range_end);
+
   next(parser);
-  while (parser->kind != TK_EOF)
-    do_match(parser, match);
+}
+
+/* Write the staged output from offset `from` on to `out`, and drop it. */
+static void write_staged(struct resync *resync, size_t from, FILE *out) {
+  fflush(resync->staging);
+  size_t length = ftello(resync->staging);
+  fwrite(resync->data + from, 1, length - from, out);
+  fseeko(resync->staging, from, SEEK_SET);
+}
+
+/* Keep what was printed for the record just completed. Output to stdout is
+ * written out in batches, unless it is flushed as it goes. */
+static void commit_record(struct parser *parser) {
+  struct resync *resync = parser->resync;
+
+  size_t length = ftello(resync->staging);
+  if (resync->target != stdout) {
+    if (length > resync->committed)
+      write_staged(resync, resync->committed, resync->target);
+    resync->target = stdout;
+  } else if (length >= RESYNC_BATCH_SIZE ||
+             (parser->print_option & PRINT_FLUSH_STDOUT)) {
+    write_staged(resync, 0, stdout);
+    resync->committed = 0;
+  } else {
+    resync->committed = length;
+  }
+}
+
+/* After error() jumped back from a record, drop it with everything printed
+ * for it and resume on the line after the one it started on. The error may
+ * be found lines later, as in a truncated record, but those lines may hold
+ * valid records. An invalid first token of a record is found while lexing
+ * past the end of the one before, so that one is dropped as well. */
+static void skip_invalid_record(struct parser *parser) {
+  struct resync *resync = parser->resync;
+  struct input *input = parser->input;
+
+  PROFILE_UNWIND();
+
+  /* keys of matched members are committed in frame order */
+  while (parser->nframe) {
+    struct match_frame *frame = &parser->frames[--parser->nframe];
+    if (frame->selector && frame->kind == TK_LBRACE)
+      strpool_free(parser->strpool, frame->selector->matched_keylen);
+  }
+  parser->ncontainer = 0;
+
+  input_unmark(input);
+  if (parser->tape)
+    parser->tape->limit = 0;
+  if (parser->partition)
+    parser->partition->capturing = false;
+  if (parser->in_set)
+    parser->in_set->testing = false;
+  if (parser->groups)
+    group_table_discard(parser->groups);
+  if (parser->framing)
+    fseeko(parser->framing->buffer, 0, SEEK_SET);
+  if (parser->encoder) {
+    parser->encoder->length = 0;
+    parser->encoder->nopen = 0;
+  }
+
+  parser->out = resync->staging;
+  fseeko(resync->staging, resync->committed, SEEK_SET);
+  resync->target = stdout;
+  parser->limit = resync->limit;
+
+  /* a string cannot hold a newline, so one ends the record in NDJSON */
+  input_rewind(input, resync->record);
+  input_skip_line(input);
+
+  size_t resume = input_tell(input);
+  input_hold(input, resume);
+  if (resync->errors) {
+    fprintf(resync->errors,
+            "{\"offset\":%zu,\"length\":%zu,\"error_offset\":%zu,\"error\":",
+            resync->record, resume - resync->record, resync->error_offset);
+    print_quoted(resync->errors, (const unsigned char *)resync->message,
+                 strlen(resync->message));
+    fputs("}\n", resync->errors);
+  }
+  ++resync->skipped;
+
+  parser->line_start = resume;
+  resync->record = resume;
+  next(parser);
+}
+
+void start_stream_matching(struct parser *parser, struct match *match) {
+  if (!parser->resync) {
+    next(parser);
+  } else if (setjmp(parser->resync->recover) == 0) {
+    /* the record is held buffered until the next one starts, so that
+     * skip_invalid_record() can always go back to it */
+    parser->resync->record = input_tell(parser->input);
+    input_hold(parser->input, parser->resync->record);
+    next(parser);
+  } else {
+    skip_invalid_record(parser);
+  }
+
+  if (parser->follow)
+    follow_next_value(parser);
+
+  while (parser->kind != TK_EOF && parser->limit != 0 &&
+         parser->line_start < parser->range_end) {
+    if (parser->sampler && !sampler_take(parser->sampler)) {
+      skip_unsampled(parser);
+      if (parser->kind == TK_EOF || parser->line_start >= parser->range_end)
+        break;
+    }
+
+    if (parser->resync) {
+      parser->resync->record = parser->input->token;
+      parser->resync->limit = parser->limit;
+      input_hold(parser->input, parser->resync->record);
+    }
+
+    if (parser->in_set && !match_in_set(parser)) {
+      /* filtered out, the value was consumed */
+    } else if (parser->partition) {
+      match_partitioned(parser, match);
+    } else if (parser->top) {
+      match_top(parser, match);
+    } else {
+      match_output(parser, match);
+    }
+
+    if (parser->groups)
+      group_table_commit(parser->groups);
+
+    if (parser->resync)
+      commit_record(parser);
+
+    /* the next value starts at the current token, which is the end of the
+     * file if the value just processed is the last one for now */
+    if (parser->follow) {
+      if (!follow_processed(parser->follow, parser->input->token))
+        break;
+      follow_next_value(parser);
+    }
+  }
+
+  if (parser->resync) {
+    write_staged(parser->resync, 0, stdout);
+    input_release(parser->input);
+  }
 }
@@ -1,9 +1,24 @@
 #ifndef _PARSER_H
 #define _PARSER_H
 
+#include "decoder.h"
+#include "encoder.h"
+#include "flush.h"
+#include "follow.h"
+#include "framing.h"
+#include "group.h"
+#include "hll.h"
+#include "idset.h"
+#include "input.h"
 #include "match.h"
+#include "partition.h"
+#include "sample.h"
+#include "tape.h"
+#include "top.h"
+#include "unique.h"
 
 #include <assert.h>
+#include <setjmp.h>
 #include <stdio.h>
 
 union tokenattr {
@@ -32,18 +47,164 @@ enum print_option: unsigned char {
   PRINT_RAW = 1,
   PRINT_NULL_SEP = 2,
   PRINT_FLUSH_STDOUT = 4,
+  PRINT_PASSTHROUGH = 8,
+  PRINT_MINIFY = 16,
+  PRINT_PROJECT = 32,
+};
+
+/* A container being matched against `match`. Frames live on an explicit
+ * stack in the parser, so nesting depth is not bounded by the C stack. */
+struct match_frame {
+  struct match *match;
+  /* selector whose submatch is running on the current member, or NULL */
+  struct selector *selector;
+  size_t index;
+  /* stream offsets of the current member, its key for an object, and of the
+   * comma before it or SIZE_MAX */
+  size_t member;
+  size_t comma;
+  enum tokenkind kind;
+  /* the member was found by key order speculation, so the rest of the
+   * object is skipped without lexing it */
+  bool speculated;
+};
+
+/* A container open in the output of PRINT_PROJECT. Level i > 0 was entered
+ * through member `key` or `index` of level i - 1. */
+struct projection_level {
+  enum tokenkind kind;
+  bool nonempty;
+  size_t index;
+  /* offset and length of the key in the projection's key buffer */
+  size_t key;
+  size_t keylen;
+};
+
+/* Containers open in the output of PRINT_PROJECT, which writes the matches
+ * of a value as one object with their paths preserved. */
+struct projection {
+  struct projection_level *levels;
+  size_t nlevel;
+  size_t level_capacity;
+  unsigned char *keys;
+  size_t keys_length;
+  size_t keys_capacity;
+};
+
+/* State of the rewriting passthrough of --delete and --mask. */
+struct redaction {
+  /* JSON text replacing matched values, or NULL to delete them */
+  const char *mask;
+  /* stream offset up to which the current value was printed */
+  size_t cursor;
+  /* whether whitespace at the cursor is dropped, after a dropped comma */
+  bool trim;
+  /* whether the whole value was deleted */
+  bool dropped;
+};
+
+/* Output staged by --skip-invalid is written to stdout in batches of at
+ * least this many bytes. */
+constexpr size_t RESYNC_BATCH_SIZE = 1 << 16;
+
+/* State of --skip-invalid, which drops records with errors in stream mode
+ * instead of exiting. Output of a record is staged until it is complete. */
+struct resync {
+  /* error() jumps back here */
+  jmp_buf recover;
+  /* gets a line for every record dropped, or NULL */
+  FILE *errors;
+  FILE *staging;
+  char *data;
+  size_t size;
+  /* staged output of earlier records, not yet written to stdout */
+  size_t committed;
+  /* where the staged output of the current record goes */
+  FILE *target;
+  /* stream offset of the current record and the limit before it */
+  size_t record;
+  size_t limit;
+  /* the error that ended the current record */
+  size_t error_offset;
+  char message[96];
+  /* number of records dropped */
+  size_t skipped;
 };
 
 struct parser {
-  FILE *file;
+  struct input *input;
   union tokenattr attr;
   unsigned int length;
   enum tokenkind kind;
   enum print_option print_option;
   struct strpool *strpool;
   const char *delimiter;
+  /* where matches are printed */
+  FILE *out;
+  /* kinds of open containers while skipping or printing */
+  enum tokenkind *containers;
+  size_t ncontainer;
+  size_t container_capacity;
+  struct match_frame *frames;
+  size_t nframe;
+  size_t frame_capacity;
+  /* maximum nesting depth of the input */
+  size_t max_depth;
+  /* structural index used to skip containers, or NULL */
+  struct tape *tape;
+  /* used with PRINT_FLUSH_STDOUT */
+  struct flush_policy *flush;
+  /* told about every top-level value processed in stream mode, or NULL */
+  struct follow *follow;
+  /* in stream mode, only values holding a member are matched, or NULL */
+  struct id_set *in_set;
+  /* routes values to per-partition files in stream mode, or NULL */
+  struct partition *partition;
+  /* with --unique, matches printed so far, or NULL */
+  struct value_set *unique;
+  /* with --count-distinct, sketch of the matches instead of printing
+   * them, or NULL */
+  struct hll *distinct;
+  /* with --group-by, table the matches are aggregated into instead of
+   * printing them, or NULL */
+  struct group_table *groups;
+  /* with --top, the records with the largest numbers matched in them, or
+   * NULL */
+  struct top *top;
+  /* reads MessagePack or CBOR input instead of JSON, or NULL */
+  struct decoder *decoder;
+  /* with `decoder`, length of the payload of the string value just lexed
+   * while it is still in the input, see load_string() */
+  size_t unread;
+  /* transcodes printed values to MessagePack or CBOR, or NULL */
+  struct encoder *encoder;
+  /* writes printed values as length-prefixed frames, or NULL */
+  struct framing *framing;
+  /* used with PRINT_PROJECT */
+  struct projection *projection;
+  /* rewrites matched values instead of printing them, or NULL */
+  struct redaction *redaction;
+  /* buffer for the key of a value */
+  unsigned char *scratch;
+  size_t scratch_capacity;
+  /* in stream mode, drops records with errors instead of exiting, or
+   * NULL */
+  struct resync *resync;
+  /* selects the NDJSON records to process in stream mode, or NULL */
+  struct sampler *sampler;
+  /* jump to the member a key of a chain was found at in earlier records */
+  bool speculate;
+  /* number of matches still to be printed before stopping */
+  size_t limit;
+  /* stream offset of the line holding the current token */
+  size_t line_start;
+  /* in stream mode, records on lines starting at or after this offset are
+   * left to the next shard */
+  size_t range_end;
 };
 
+void parser_destroy(struct parser *parser);
+
 void start_matching(struct parser *parser, struct match *match);
 void start_stream_matching(struct parser *parser, struct match *match);
 
@@ -0,0 +1,232 @@
+#include "partition.h"
+#include "hash.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *reserve(void *array, size_t *capacity, size_t size) {
+  if (likely(size <= *capacity))
+    return array;
+
+  size_t new_capacity = *capacity ? *capacity : 64;
+  while (new_capacity < size)
+    new_capacity *= 2;
+
+  void *new_array = realloc(array, new_capacity);
+  if (unlikely(!new_array))
+    out_of_memory();
+
+  *capacity = new_capacity;
+  return new_array;
+}
+
+void partition_init(struct partition *partition, struct match *key,
+                    const char *template, size_t max_open) {
+  partition->key = key;
+  partition->template = template;
+  partition->max_open = max_open;
+  partition->nopen = 0;
+  partition->most_recent = NULL;
+  partition->least_recent = NULL;
+  partition->table_size = 256;
+  partition->table = calloc(partition->table_size, sizeof(*partition->table));
+  if (unlikely(!partition->table))
+    out_of_memory();
+  partition->nfile = 0;
+  partition->value = NULL;
+  partition->length = 0;
+  partition->value_capacity = 0;
+  partition->has_value = false;
+  partition->capturing = false;
+  partition->path = NULL;
+  partition->path_capacity = 0;
+}
+
+static void close_file(struct partition_file *file) {
+  if (fclose(file->file) != 0) {
+    fprintf(stderr, "write error: %s\n", strerror(errno));
+    exit(1);
+  }
+  file->file = NULL;
+}
+
+void partition_destroy(struct partition *partition) {
+  for (size_t i = 0; i < partition->table_size; ++i) {
+    struct partition_file *file = partition->table[i];
+    if (!file)
+      continue;
+
+    if (file->file)
+      close_file(file);
+    free(file->value);
+    free(file);
+  }
+
+  free(partition->table);
+  free(partition->value);
+  free(partition->path);
+}
+
+void partition_set_value(struct partition *partition,
+                         const unsigned char *value, size_t length) {
+  partition->value = reserve(partition->value, &partition->value_capacity,
+                             length + 1);
+  memcpy(partition->value, value, length);
+  partition->length = length;
+  partition->has_value = true;
+}
+
+static void grow_table(struct partition *partition) {
+  size_t table_size = partition->table_size * 2;
+  struct partition_file **table = calloc(table_size, sizeof(*table));
+  if (unlikely(!table))
+    out_of_memory();
+
+  for (size_t i = 0; i < partition->table_size; ++i) {
+    struct partition_file *file = partition->table[i];
+    if (!file)
+      continue;
+
+    size_t j = file->hash & (table_size - 1);
+    while (table[j])
+      j = (j + 1) & (table_size - 1);
+    table[j] = file;
+  }
+
+  free(partition->table);
+  partition->table = table;
+  partition->table_size = table_size;
+}
+
+static struct partition_file *lookup(struct partition *partition) {
+  uint64_t hash = hash_bytes(partition->value, partition->length);
+  size_t mask = partition->table_size - 1;
+
+  size_t i = hash & mask;
+  for (struct partition_file *file; (file = partition->table[i]);
+       i = (i + 1) & mask) {
+    if (file->hash == hash && file->length == partition->length &&
+        memcmp(file->value, partition->value, partition->length) == 0)
+      return file;
+  }
+
+  struct partition_file *file = malloc(sizeof(*file));
+  unsigned char *value = malloc(partition->length + 1);
+  if (unlikely(!file || !value))
+    out_of_memory();
+
+  memcpy(value, partition->value, partition->length);
+  *file = (struct partition_file) {
+    .value = value,
+    .length = partition->length,
+    .hash = hash,
+    .file = NULL,
+    .created = false,
+    .prev = NULL,
+    .next = NULL,
+  };
+
+  partition->table[i] = file;
+  if (2 * ++partition->nfile > partition->table_size)
+    grow_table(partition);
+
+  return file;
+}
+
+static void unlink_file(struct partition *partition,
+                        struct partition_file *file) {
+  if (file->prev) {
+    file->prev->next = file->next;
+  } else {
+    partition->most_recent = file->next;
+  }
+
+  if (file->next) {
+    file->next->prev = file->prev;
+  } else {
+    partition->least_recent = file->prev;
+  }
+}
+
+static void push_most_recent(struct partition *partition,
+                             struct partition_file *file) {
+  file->prev = NULL;
+  file->next = partition->most_recent;
+  if (file->next) {
+    file->next->prev = file;
+  } else {
+    partition->least_recent = file;
+  }
+  partition->most_recent = file;
+}
+
+static inline bool is_safe(unsigned char ch) {
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+         (ch >= '0' && ch <= '9') || ch == '_' || ch == '-' || ch == '.' ||
+         ch >= 0x80;
+}
+
+/* unsafe bytes become %XX, an empty value a lone '%' */
+static const char *file_path(struct partition *partition,
+                             struct partition_file *file) {
+  const char *template = partition->template;
+  const char *hole = strstr(template, "{}");
+  size_t prefix = hole - template;
+  size_t suffix = strlen(hole + 2);
+
+  partition->path = reserve(partition->path, &partition->path_capacity,
+                            prefix + 3 * file->length + suffix + 1);
+
+  char *out = partition->path;
+  memcpy(out, template, prefix);
+  out += prefix;
+
+  if (file->length == 0)
+    *out++ = '%';
+
+  for (size_t i = 0; i < file->length; ++i) {
+    unsigned char ch = file->value[i];
+    if (is_safe(ch) && !(i == 0 && ch == '.')) {
+      *out++ = ch;
+    } else {
+      out += sprintf(out, "%%%02X", ch);
+    }
+  }
+
+  memcpy(out, hole + 2, suffix + 1);
+  return partition->path;
+}
+
+FILE *partition_file(struct partition *partition) {
+  struct partition_file *file = lookup(partition);
+
+  if (likely(file->file)) {
+    if (file != partition->most_recent) {
+      unlink_file(partition, file);
+      push_most_recent(partition, file);
+    }
+    return file->file;
+  }
+
+  if (partition->nopen == partition->max_open) {
+    struct partition_file *victim = partition->least_recent;
+    unlink_file(partition, victim);
+    close_file(victim);
+    --partition->nopen;
+  }
+
+  const char *path = file_path(partition, file);
+  file->file = fopen(path, file->created ? "a" : "w");
+  if (unlikely(!file->file)) {
+    fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+
+  file->created = true;
+  push_most_recent(partition, file);
+  ++partition->nopen;
+  return file->file;
+}
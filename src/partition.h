@@ -0,0 +1,56 @@
+#ifndef _PARTITION_H
+#define _PARTITION_H
+
+#include "match.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct partition_file {
+  unsigned char *value;
+  size_t length;
+  uint64_t hash;
+  /* NULL while evicted from the pool */
+  FILE *file;
+  /* whether the file was opened before, and so is appended to */
+  bool created;
+  /* neighbours in the list of open files, most recently used first */
+  struct partition_file *prev;
+  struct partition_file *next;
+};
+
+/* --partition-by output, with an LRU pool of open files */
+struct partition {
+  struct match *key;
+  /* file name with "{}" standing for the partition value */
+  const char *template;
+  size_t max_open;
+  size_t nopen;
+  struct partition_file *most_recent;
+  struct partition_file *least_recent;
+  /* open addressing hash table of all files, indexed by value */
+  struct partition_file **table;
+  size_t table_size;
+  size_t nfile;
+  /* partition value of the current record, if `has_value` */
+  unsigned char *value;
+  size_t length;
+  size_t value_capacity;
+  bool has_value;
+  /* set while the key is being matched */
+  bool capturing;
+  char *path;
+  size_t path_capacity;
+};
+
+void partition_init(struct partition *partition, struct match *key,
+                    const char *template, size_t max_open);
+void partition_destroy(struct partition *partition);
+
+void partition_set_value(struct partition *partition,
+                         const unsigned char *value, size_t length);
+
+FILE *partition_file(struct partition *partition);
+
+#endif
@@ -0,0 +1,275 @@
+/* for syscall(2) */
+#define _DEFAULT_SOURCE
+
+#include "profile.h"
+#include "utils.h"
+
+#if defined(FJ_PROFILE)
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/* deepest nesting of phases, as in skip_value() > next() > strpool */
+constexpr size_t PROFILE_MAX_DEPTH = 16;
+
+/* number of samples taken to estimate the cost of one */
+constexpr size_t CALIBRATION_SAMPLES = 4096;
+
+enum profile_counter: unsigned char {
+  COUNTER_CYCLES,
+  COUNTER_INSTRUCTIONS,
+  COUNTER_BRANCH_MISSES,
+  COUNTER_CACHE_MISSES,
+  /* nanoseconds, always available */
+  COUNTER_TIME,
+  COUNTER_COUNT,
+};
+
+static const char *phase_names[PHASE_COUNT] = {
+  [PHASE_OTHER] = "other",
+  [PHASE_LEX] = "next",
+  [PHASE_SKIP] = "skip_value",
+  [PHASE_PRINT_STRING] = "print_string",
+  [PHASE_STRPOOL] = "strpool",
+};
+
+static struct {
+  /* file descriptors of the hardware counters, or -1 */
+  int fds[COUNTER_TIME];
+#if defined(__linux__)
+  /* pages for reading the counters with rdpmc, or NULL */
+  struct perf_event_mmap_page *pages[COUNTER_TIME];
+#endif
+  /* errno of opening the cycle counter, 0 if it was opened */
+  int error;
+  uint64_t last[COUNTER_COUNT];
+  uint64_t totals[PHASE_COUNT][COUNTER_COUNT];
+  size_t calls[PHASE_COUNT];
+  enum profile_phase stack[PROFILE_MAX_DEPTH];
+  size_t depth;
+  /* counts added by taking one sample */
+  uint64_t overhead[COUNTER_COUNT];
+} profile;
+
+#if defined(__linux__)
+static int open_counter(uint64_t config, int group) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = group < 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+static inline uint64_t rdpmc(uint32_t counter) {
+  uint32_t low, high;
+  __asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+  return (uint64_t)high << 32 | low;
+}
+
+/* Read a counter from userspace as described in perf_event_open(2).
+ * Returns false if it is not on the PMU right now. */
+static bool read_page(struct perf_event_mmap_page *page, uint64_t *value) {
+  uint32_t seq;
+  do {
+    seq = page->lock;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+    uint32_t index = page->index;
+    if (!page->cap_user_rdpmc || index == 0)
+      return false;
+
+    uint64_t count = rdpmc(index - 1);
+    unsigned shift = 64 - page->pmc_width;
+    *value = page->offset + (uint64_t)((int64_t)(count << shift) >> shift);
+
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  } while (page->lock != seq);
+
+  return true;
+}
+#endif
+
+static void sample(uint64_t *values) {
+  for (size_t i = 0; i < COUNTER_TIME; ++i) {
+    values[i] = 0;
+    if (profile.fds[i] < 0)
+      continue;
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+    if (profile.pages[i] && read_page(profile.pages[i], &values[i]))
+      continue;
+#endif
+    if (read(profile.fds[i], &values[i], sizeof(values[i])) !=
+        sizeof(values[i]))
+      values[i] = 0;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  values[COUNTER_TIME] = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Add the counts since the last sample to the current phase. */
+static void attribute(void) {
+  uint64_t values[COUNTER_COUNT];
+  sample(values);
+
+  enum profile_phase phase =
+      profile.depth ? profile.stack[profile.depth - 1] : PHASE_OTHER;
+  for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+    profile.totals[phase][i] += values[i] - profile.last[i];
+    profile.last[i] = values[i];
+  }
+}
+
+static void calibrate(void) {
+  uint64_t first[COUNTER_COUNT];
+  uint64_t values[COUNTER_COUNT];
+
+  sample(first);
+  for (size_t i = 0; i < CALIBRATION_SAMPLES; ++i)
+    sample(values);
+
+  for (size_t i = 0; i < COUNTER_COUNT; ++i)
+    profile.overhead[i] = (values[i] - first[i]) / CALIBRATION_SAMPLES;
+}
+
+void profile_start(void) {
+  static const uint64_t configs[COUNTER_TIME] = {
+#if defined(__linux__)
+    [COUNTER_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+    [COUNTER_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    [COUNTER_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+    [COUNTER_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+#endif
+  };
+
+  for (size_t i = 0; i < COUNTER_TIME; ++i)
+    profile.fds[i] = -1;
+
+#if defined(__linux__)
+  /* the cycle counter leads a group, so all are scheduled together */
+  int leader = open_counter(configs[COUNTER_CYCLES], -1);
+  if (leader < 0) {
+    profile.error = errno;
+  } else {
+    profile.fds[COUNTER_CYCLES] = leader;
+    for (size_t i = 1; i < COUNTER_TIME; ++i)
+      profile.fds[i] = open_counter(configs[i], leader);
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < COUNTER_TIME; ++i) {
+      profile.pages[i] = NULL;
+      if (profile.fds[i] < 0)
+        continue;
+
+      void *page = mmap(NULL, page_size, PROT_READ, MAP_SHARED,
+                        profile.fds[i], 0);
+      if (page != MAP_FAILED)
+        profile.pages[i] = page;
+    }
+
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+#else
+  profile.error = ENOSYS;
+#endif
+
+  calibrate();
+  sample(profile.last);
+}
+
+void profile_enter(enum profile_phase phase) {
+  attribute();
+  if (likely(profile.depth < PROFILE_MAX_DEPTH))
+    profile.stack[profile.depth] = phase;
+  ++profile.depth;
+  ++profile.calls[phase];
+}
+
+void profile_exit(void) {
+  attribute();
+  --profile.depth;
+}
+
+void profile_unwind(void) {
+  attribute();
+  profile.depth = 0;
+}
+
+/* Print `count` per byte, or "-" for a counter that is not available. */
+static void print_per_byte(FILE *out, enum profile_counter counter,
+                           uint64_t count, size_t bytes) {
+  if (counter != COUNTER_TIME && profile.fds[counter] < 0) {
+    fprintf(out, " %12s", "-");
+  } else {
+    fprintf(out, " %12.4f", bytes ? (double)count / bytes : 0.0);
+  }
+}
+
+void profile_report(FILE *out, size_t bytes) {
+  static const char *counter_names[COUNTER_COUNT] = {
+    [COUNTER_CYCLES] = "cycles/B",
+    [COUNTER_INSTRUCTIONS] = "instr/B",
+    [COUNTER_BRANCH_MISSES] = "br-miss/B",
+    [COUNTER_CACHE_MISSES] = "cache-miss/B",
+    [COUNTER_TIME] = "ns/B",
+  };
+
+  attribute();
+
+  if (profile.error)
+    fprintf(out, "hardware counters unavailable: %s\n",
+            strerror(profile.error));
+
+  fprintf(out, "%zu bytes, each phase change adds about %llu ns",
+          bytes, (unsigned long long)profile.overhead[COUNTER_TIME]);
+  if (profile.fds[COUNTER_CYCLES] >= 0)
+    fprintf(out, " and %llu cycles",
+            (unsigned long long)profile.overhead[COUNTER_CYCLES]);
+  fputs(", included below\n", out);
+
+  fprintf(out, "%-12s %12s", "phase", "calls");
+  for (size_t i = 0; i < COUNTER_COUNT; ++i)
+    fprintf(out, " %12s", counter_names[i]);
+  fprintf(out, " %6s %6s\n", "IPC", "time%");
+
+  uint64_t total_time = 0;
+  for (size_t phase = 0; phase < PHASE_COUNT; ++phase)
+    total_time += profile.totals[phase][COUNTER_TIME];
+
+  for (size_t phase = 0; phase < PHASE_COUNT; ++phase) {
+    uint64_t *totals = profile.totals[phase];
+    fprintf(out, "%-12s %12zu", phase_names[phase], profile.calls[phase]);
+    for (size_t i = 0; i < COUNTER_COUNT; ++i)
+      print_per_byte(out, i, totals[i], bytes);
+
+    if (profile.fds[COUNTER_INSTRUCTIONS] >= 0 && totals[COUNTER_CYCLES]) {
+      fprintf(out, " %6.2f",
+              (double)totals[COUNTER_INSTRUCTIONS] / totals[COUNTER_CYCLES]);
+    } else {
+      fprintf(out, " %6s", "-");
+    }
+    fprintf(out, " %6.1f\n",
+            total_time ? 100.0 * totals[COUNTER_TIME] / total_time : 0.0);
+  }
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Hardware counter profiling of the hot paths, compiled in with
+ * -DFJ_PROFILE by `make profile`. Counts are attributed to the innermost
+ * phase entered, so the lexing done while skipping a value counts for
+ * PHASE_LEX and the rest of skip_value() for PHASE_SKIP. */
+enum profile_phase: unsigned char {
+  /* everything outside of the phases below */
+  PHASE_OTHER,
+  PHASE_LEX,
+  PHASE_SKIP,
+  PHASE_PRINT_STRING,
+  PHASE_STRPOOL,
+  PHASE_COUNT,
+};
+
+#if defined(FJ_PROFILE)
+/* Open the counters and start attributing to PHASE_OTHER. Without
+ * permission for perf_event_open(2), only time is measured. */
+void profile_start(void);
+void profile_enter(enum profile_phase phase);
+void profile_exit(void);
+/* Leave all phases, after error() jumped out of them. */
+void profile_unwind(void);
+/* Print the breakdown per phase, relative to `bytes` of input. */
+void profile_report(FILE *out, size_t bytes);
+
+#define PROFILE_START() profile_start()
+#define PROFILE_ENTER(phase) profile_enter(phase)
+#define PROFILE_EXIT() profile_exit()
+#define PROFILE_UNWIND() profile_unwind()
+#define PROFILE_REPORT(out, bytes) profile_report(out, bytes)
+#else
+#define PROFILE_START() ((void)0)
+#define PROFILE_ENTER(phase) ((void)0)
+#define PROFILE_EXIT() ((void)0)
+#define PROFILE_UNWIND() ((void)0)
+#define PROFILE_REPORT(out, bytes) ((void)0)
+#endif
+
+#endif
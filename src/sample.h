@@ -0,0 +1,52 @@
+#ifndef _SAMPLE_H
+#define _SAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Picks the NDJSON records processed in stream mode, either every n-th
+ * record or each record independently with a fixed probability. */
+struct sampler {
+  size_t every;
+  size_t countdown;
+  /* a record is taken if the next random number is below this */
+  uint64_t threshold;
+  uint64_t state;
+  bool random;
+};
+
+static inline void sampler_init_every(struct sampler *sampler, size_t every) {
+  sampler->every = every;
+  sampler->countdown = 1;
+  sampler->random = false;
+}
+
+static inline void sampler_init_random(struct sampler *sampler,
+                                       double probability, uint64_t seed) {
+  sampler->threshold = probability >= 1.0
+                           ? UINT64_MAX
+                           : (uint64_t)(probability * 18446744073709551616.0);
+  /* xorshift state must not be zero */
+  sampler->state = seed ? seed : 0x9E3779B97F4A7C15ull;
+  sampler->random = true;
+}
+
+/* Whether to process the next record. */
+static inline bool sampler_take(struct sampler *sampler) {
+  if (!sampler->random) {
+    if (--sampler->countdown != 0)
+      return false;
+    sampler->countdown = sampler->every;
+    return true;
+  }
+
+  /* xorshift64* */
+  uint64_t x = sampler->state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  sampler->state = x;
+  return x * 0x2545F4914F6CDD1Dull < sampler->threshold;
+}
+
+#endif
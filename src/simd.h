@@ -0,0 +1,182 @@
+#ifndef _SIMD_H
+#define _SIMD_H
+
+#include "utils.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Vectorized byte scanners. With SSE2 they compare 16 bytes at a time,
+ * otherwise they fall back to SWAR on 64-bit words. */
+
+#if !defined(__SSE2__)
+static inline uint64_t swar_broadcast(unsigned char ch) {
+  return 0x0101010101010101ull * ch;
+}
+
+/* Non-zero iff some byte of `word` is zero. */
+static inline uint64_t swar_has_zero(uint64_t word) {
+  return (word - 0x0101010101010101ull) & ~word & 0x8080808080808080ull;
+}
+
+static inline uint64_t swar_load(const unsigned char *p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+/* Non-zero iff some byte of `word` is below `bound`, which must not be above
+ * 128. */
+static inline uint64_t swar_has_less(uint64_t word, unsigned char bound) {
+  return (word - swar_broadcast(bound)) & ~word & 0x8080808080808080ull;
+}
+#endif
+
+/* Return the first position in [p, end) holding `a` or `b`, or `end` if
+ * there is none. */
+static inline unsigned char *simd_find2(unsigned char *p, unsigned char *end,
+                                        unsigned char a, unsigned char b) {
+#if defined(__SSE2__)
+  const __m128i va = _mm_set1_epi8((char)a);
+  const __m128i vb = _mm_set1_epi8((char)b);
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    unsigned mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#else
+  const uint64_t va = swar_broadcast(a);
+  const uint64_t vb = swar_broadcast(b);
+  while (end - p >= 8) {
+    uint64_t word = swar_load(p);
+    if (swar_has_zero(word ^ va) | swar_has_zero(word ^ vb))
+      break;
+    p += 8;
+  }
+#endif
+
+  while (p != end && *p != a && *p != b)
+    ++p;
+
+  return p;
+}
+
+/* Return the first position in [p, end) holding '"' or a byte not above ' ',
+ * or `end` if there is none. */
+static inline unsigned char *simd_find_quote_or_space(unsigned char *p,
+                                                      unsigned char *end) {
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i space = _mm_set1_epi8(' ');
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    __m128i is_space = _mm_cmpeq_epi8(_mm_min_epu8(chunk, space), chunk);
+    unsigned mask = _mm_movemask_epi8(
+        _mm_or_si128(is_space, _mm_cmpeq_epi8(chunk, quote)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#else
+  const uint64_t quote = swar_broadcast('"');
+  while (end - p >= 8) {
+    uint64_t word = swar_load(p);
+    if (swar_has_less(word, ' ' + 1) | swar_has_zero(word ^ quote))
+      break;
+    p += 8;
+  }
+#endif
+
+  while (p != end && *p != '"' && *p > ' ')
+    ++p;
+
+  return p;
+}
+
+/* Return the first position in [p, end) holding '"', '\\', a control
+ * character or a byte of a multibyte UTF-8 sequence, or `end` if there is
+ * none. Everything before it is plain ASCII string content. */
+static inline unsigned char *simd_find_string_stop(unsigned char *p,
+                                                   unsigned char *end) {
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1f);
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    __m128i is_control = _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk);
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                   _mm_cmpeq_epi8(chunk, backslash));
+    /* the sign bits of the chunk itself flag non-ASCII bytes */
+    unsigned mask = _mm_movemask_epi8(_mm_or_si128(special, is_control)) |
+                    _mm_movemask_epi8(chunk);
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#else
+  const uint64_t quote = swar_broadcast('"');
+  const uint64_t backslash = swar_broadcast('\\');
+  while (end - p >= 8) {
+    uint64_t word = swar_load(p);
+    if ((word & 0x8080808080808080ull) | swar_has_less(word, 0x20) |
+        swar_has_zero(word ^ quote) | swar_has_zero(word ^ backslash))
+      break;
+    p += 8;
+  }
+#endif
+
+  while (p != end && *p != '"' && *p != '\\' && *p >= 0x20 && *p < 0x80)
+    ++p;
+
+  return p;
+}
+
+/* A 64-byte block loaded for classification. simd64_eq() returns a mask with
+ * bit i set iff byte i of the block equals `ch`. */
+#if defined(__SSE2__)
+struct simd64 {
+  __m128i chunk[4];
+};
+
+static inline void simd64_load(struct simd64 *block, const unsigned char *p) {
+  for (size_t i = 0; i < 4; ++i)
+    block->chunk[i] = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+}
+
+static inline uint64_t simd64_eq(const struct simd64 *block, unsigned char ch) {
+  const __m128i v = _mm_set1_epi8((char)ch);
+  uint64_t mask = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    uint64_t bits =
+        (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block->chunk[i], v));
+    mask |= bits << (16 * i);
+  }
+  return mask;
+}
+#else
+struct simd64 {
+  const unsigned char *p;
+};
+
+static inline void simd64_load(struct simd64 *block, const unsigned char *p) {
+  block->p = p;
+}
+
+static inline uint64_t simd64_eq(const struct simd64 *block, unsigned char ch) {
+  uint64_t mask = 0;
+  for (size_t i = 0; i < 64; ++i)
+    mask |= (uint64_t)(block->p[i] == ch) << i;
+  return mask;
+}
+#endif
+
+#endif
@@ -1,4 +1,6 @@
 #include "strpool.h"
+#include "hugepage.h"
+#include "profile.h"
 #include "utils.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,11 +34,10 @@ static inline void store_current_block_info(struct strpool *strpool) {
 
 void strpool_init(struct strpool *strpool) {
   struct block *block = malloc(sizeof(struct block) + BUFFER_SIZE);
-  if (unlikely(!block)) {
-    fputs("out of memory", stderr);
-    exit(1);
-  }
+  if (unlikely(!block))
+    out_of_memory();
 
+  strpool->huge_pages = false;
   block->remaining_size = BUFFER_SIZE;
   block->end = block->buf + BUFFER_SIZE;
   block->curr = block->buf;
@@ -64,6 +65,10 @@ void strpool_destroy(struct strpool *strpool) {
   }
 }
 
+void strpool_use_huge_pages(struct strpool *strpool) {
+  strpool->huge_pages = true;
+}
+
 static void next_available_block(struct strpool *strpool, size_t size) {
   while (strpool->current_block->next) {
     struct block *block = strpool->current_block->next;
@@ -75,10 +80,15 @@ static void next_available_block(struct strpool *strpool, size_t size) {
     }
   }
 
-  struct block *block = malloc(sizeof(struct block) + size);
-  if (unlikely(!block)) {
-    fputs("out of memory", stderr);
-    exit(1);
+  struct block *block;
+  if (strpool->huge_pages) {
+    size_t block_size = huge_page_round(sizeof(struct block) + size);
+    block = huge_alloc(block_size);
+    size = block_size - sizeof(struct block);
+  } else {
+    block = malloc(sizeof(struct block) + size);
+    if (unlikely(!block))
+      out_of_memory();
   }
 
   block->remaining_size = size;
@@ -98,10 +108,8 @@ static void realloc_current_block(struct strpool *strpool, size_t size) {
   size_t used_size = block->curr - block->buf;
 
   struct block *new_block = realloc(block, sizeof(struct block) + size);
-  if (unlikely(!new_block)) {
-    fputs("out of memory", stderr);
-    exit(1);
-  }
+  if (unlikely(!new_block))
+    out_of_memory();
 
   new_block->remaining_size = size - used_size;
   new_block->end = new_block->buf + size;
@@ -120,6 +128,8 @@ static void realloc_current_block(struct strpool *strpool, size_t size) {
 unsigned char *strpool_alloc_fallback(struct strpool *strpool, size_t size) {
   assert(size != 0);
 
+  PROFILE_ENTER(PHASE_STRPOOL);
+
   store_current_block_info(strpool);
 
   if (unlikely(strpool->currpos == strpool->current_block->buf)) {
@@ -130,6 +140,7 @@ unsigned char *strpool_alloc_fallback(struct strpool *strpool, size_t size) {
   }
 
   load_current_block_info(strpool);
+  PROFILE_EXIT();
   return strpool->currpos;
 }
 
@@ -137,6 +148,8 @@ unsigned char *strpool_realloc_fallback(struct strpool *strpool,
                                         size_t new_size) {
   assert(new_size != 0);
 
+  PROFILE_ENTER(PHASE_STRPOOL);
+
   store_current_block_info(strpool);
 
   if (unlikely(strpool->currpos == strpool->current_block->buf)) {
@@ -150,12 +163,15 @@ unsigned char *strpool_realloc_fallback(struct strpool *strpool,
   }
 
   load_current_block_info(strpool);
+  PROFILE_EXIT();
   return strpool->currpos;
 }
 
 void strpool_free_fallback(struct strpool *strpool, size_t size) {
   assert(strpool->currpos == strpool->current_block->buf);
 
+  PROFILE_ENTER(PHASE_STRPOOL);
+
   store_current_block_info(strpool);
 
   strpool->current_block = strpool->current_block->prev;
@@ -165,5 +181,6 @@ void strpool_free_fallback(struct strpool *strpool, size_t size) {
 
   load_current_block_info(strpool);
   strpool->currpos -= size;
+  PROFILE_EXIT();
   return;
 }
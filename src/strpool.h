@@ -26,11 +26,17 @@ struct strpool {
   unsigned char *currpos;
   size_t remaining_size;
   struct block *current_block;
+  /* new blocks fill whole huge pages */
+  bool huge_pages;
 };
 
 void strpool_init(struct strpool *strpool);
 void strpool_destroy(struct strpool *strpool);
 
+/* Allocate new blocks as whole huge pages. Blocks already allocated are
+ * kept. */
+void strpool_use_huge_pages(struct strpool *strpool);
+
 unsigned char *strpool_alloc_fallback(struct strpool *strpool, size_t size);
 unsigned char *strpool_realloc_fallback(struct strpool *strpool,
                                         size_t new_size);
@@ -56,6 +62,10 @@ static inline void strpool_commit(struct strpool *strpool, size_t size) {
 }
 
 static inline void strpool_free(struct strpool *strpool, size_t size) {
+  /* nothing was committed, as for an empty key */
+  if (unlikely(size == 0))
+    return;
+
   if (strpool->currpos == strpool->current_block->buf) {
     strpool_free_fallback(strpool, size);
     return;
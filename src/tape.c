@@ -0,0 +1,133 @@
+#include "tape.h"
+#include "simd.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void tape_init(struct tape *tape) {
+  tape->entries = NULL;
+  tape->nentry = 0;
+  tape->capacity = 0;
+  tape->cursor = 0;
+  tape->base = 0;
+  tape->limit = 0;
+  tape->stack = NULL;
+  tape->stack_capacity = 0;
+}
+
+void tape_destroy(struct tape *tape) {
+  free(tape->entries);
+  free(tape->stack);
+}
+
+static void *grow(void *array, size_t *capacity, size_t size) {
+  size_t new_capacity = *capacity ? *capacity * 2 : 256;
+  void *new_array = realloc(array, new_capacity * size);
+  if (unlikely(!new_array))
+    out_of_memory();
+
+  *capacity = new_capacity;
+  return new_array;
+}
+
+/* Mask of characters escaped by a backslash. `prev_escaped` carries whether
+ * the first character of the next block is escaped. */
+static inline uint64_t find_escaped(uint64_t backslash, uint64_t *prev_escaped) {
+  constexpr uint64_t even_bits = 0x5555555555555555ull;
+
+  backslash &= ~*prev_escaped;
+  uint64_t follows_escape = backslash << 1 | *prev_escaped;
+  uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+  uint64_t even_sequences = odd_starts + backslash;
+  *prev_escaped = even_sequences < odd_starts;
+  uint64_t invert_mask = even_sequences << 1;
+  return (even_bits ^ invert_mask) & follows_escape;
+}
+
+/* Bit i of the result is the xor of bits 0..i of `mask`. */
+static inline uint64_t prefix_xor(uint64_t mask) {
+  mask ^= mask << 1;
+  mask ^= mask << 2;
+  mask ^= mask << 4;
+  mask ^= mask << 8;
+  mask ^= mask << 16;
+  mask ^= mask << 32;
+  return mask;
+}
+
+void tape_build(struct tape *tape, const unsigned char *p, size_t len,
+                size_t offset) {
+  if (unlikely(len >= TAPE_UNCLOSED))
+    len = TAPE_UNCLOSED - 1;
+
+  tape->nentry = 0;
+  tape->cursor = 0;
+  tape->base = offset;
+  tape->limit = offset + len;
+
+  size_t nstack = 0;
+  uint64_t prev_escaped = 0;
+  uint64_t prev_in_string = 0;
+
+  for (size_t i = 0; i < len; i += 64) {
+    struct simd64 block;
+    simd64_load(&block, p + i);
+
+    uint64_t valid = len - i >= 64 ? ~0ull : (1ull << (len - i)) - 1;
+    uint64_t escaped = find_escaped(simd64_eq(&block, '\\') & valid,
+                                    &prev_escaped);
+    uint64_t quote = simd64_eq(&block, '"') & valid & ~escaped;
+    uint64_t in_string = prefix_xor(quote) ^ prev_in_string;
+    prev_in_string = -(in_string >> 63);
+
+    uint64_t open = simd64_eq(&block, '{') | simd64_eq(&block, '[');
+    uint64_t close = simd64_eq(&block, '}') | simd64_eq(&block, ']');
+    uint64_t comma = simd64_eq(&block, ',');
+    uint64_t structural = (open | close | comma) & valid & ~in_string;
+
+    while (structural) {
+      uint32_t pos = i + __builtin_ctzll(structural);
+      structural &= structural - 1;
+
+      if (unlikely(tape->nentry == tape->capacity)) {
+        tape->entries = grow(tape->entries, &tape->capacity,
+                             sizeof(*tape->entries));
+      }
+
+      if (open >> (pos - i) & 1) {
+        if (unlikely(nstack == tape->stack_capacity)) {
+          tape->stack = grow(tape->stack, &tape->stack_capacity,
+                             sizeof(*tape->stack));
+        }
+
+        tape->stack[nstack++] = tape->nentry;
+        tape->entries[tape->nentry++] = (struct tape_entry) {
+          .open = pos,
+          .close = TAPE_UNCLOSED,
+          .after = 0,
+        };
+        continue;
+      }
+
+      if ((close >> (pos - i) & 1) && nstack != 0) {
+        struct tape_entry *entry = &tape->entries[tape->stack[--nstack]];
+        /* '{' and '[' are two apart from '}' and ']' in ASCII */
+        if (likely(p[entry->open] + 2 == p[pos])) {
+          entry->close = pos;
+          /* past the entry of the closing bracket added below */
+          entry->after = tape->nentry + 1;
+        } else {
+          /* mismatched, leave the open brackets to the lexer to report */
+          nstack = 0;
+        }
+      }
+
+      tape->entries[tape->nentry++] = (struct tape_entry) {
+        .open = pos,
+        .close = pos,
+        .after = 0,
+      };
+    }
+  }
+}
@@ -0,0 +1,93 @@
+#ifndef _TAPE_H
+#define _TAPE_H
+
+#include "utils.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Structural index of a block of input, built in one vectorized pass. It
+ * records every bracket and comma outside of strings, opening brackets
+ * together with their partner, so a container can be skipped by jumping
+ * straight to its closing bracket and a member by jumping to the next comma
+ * at its level. */
+
+constexpr uint32_t TAPE_UNCLOSED = UINT32_MAX;
+constexpr size_t TAPE_NONE = SIZE_MAX;
+
+struct tape_entry {
+  /* offsets of an opening bracket and its closing bracket from `base`, or
+   * TAPE_UNCLOSED if it is not closed inside the block. For a comma or a
+   * closing bracket, both are its own offset. */
+  uint32_t open;
+  uint32_t close;
+  /* index of the first entry after the closing bracket, unused for a comma
+   * or a closing bracket */
+  uint32_t after;
+};
+
+struct tape {
+  struct tape_entry *entries;
+  size_t nentry;
+  size_t capacity;
+  /* first entry not before the last looked up offset */
+  size_t cursor;
+  /* stream offsets of the indexed block */
+  size_t base;
+  size_t limit;
+  /* open brackets during tape_build() */
+  uint32_t *stack;
+  size_t stack_capacity;
+};
+
+void tape_init(struct tape *tape);
+void tape_destroy(struct tape *tape);
+
+/* Index [p, p + len), which starts at stream offset `offset` outside of any
+ * string. 64 bytes after `p + len` must be readable. */
+void tape_build(struct tape *tape, const unsigned char *p, size_t len,
+                size_t offset);
+
+/* Return the stream offset of the bracket closing the one at stream offset
+ * `offset`, or TAPE_NONE if it is unknown. Lookups must be made in
+ * increasing order of offset. */
+static inline size_t tape_find_close(struct tape *tape, size_t offset) {
+  while (tape->cursor != tape->nentry &&
+         tape->base + tape->entries[tape->cursor].open < offset)
+    ++tape->cursor;
+
+  if (tape->cursor == tape->nentry)
+    return TAPE_NONE;
+
+  struct tape_entry *entry = &tape->entries[tape->cursor];
+  if (tape->base + entry->open != offset || entry->close == TAPE_UNCLOSED ||
+      entry->close == entry->open)
+    return TAPE_NONE;
+
+  tape->cursor = entry->after;
+  return tape->base + entry->close;
+}
+
+/* Return the stream offset of the first comma or closing bracket at or after
+ * stream offset `offset` that is not inside a container starting there or
+ * later, which ends the member or element holding `offset`. Returns
+ * TAPE_NONE if it is not in the block. Lookups must be made in increasing
+ * order of offset. */
+static inline size_t tape_find_next(struct tape *tape, size_t offset) {
+  while (tape->cursor != tape->nentry &&
+         tape->base + tape->entries[tape->cursor].open < offset)
+    ++tape->cursor;
+
+  while (tape->cursor != tape->nentry) {
+    struct tape_entry *entry = &tape->entries[tape->cursor];
+    if (entry->close == entry->open)
+      return tape->base + entry->open;
+    if (entry->close == TAPE_UNCLOSED)
+      return TAPE_NONE;
+    tape->cursor = entry->after;
+  }
+
+  return TAPE_NONE;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include "top.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void top_init(struct top *top, size_t k) {
+  top->k = k;
+  top->n = 0;
+  top->heap = calloc(k, sizeof(*top->heap));
+  if (unlikely(!top->heap))
+    out_of_memory();
+  top->number = 0.0;
+  top->has_number = false;
+}
+
+void top_destroy(struct top *top) {
+  for (size_t i = 0; i < top->k; ++i)
+    free(top->heap[i].record);
+  free(top->heap);
+}
+
+static void swap(struct top_entry *a, struct top_entry *b) {
+  struct top_entry tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+static void sift_up(struct top_entry *heap, size_t i) {
+  while (i != 0) {
+    size_t parent = (i - 1) / 2;
+    if (!(heap[i].number < heap[parent].number))
+      break;
+    swap(&heap[i], &heap[parent]);
+    i = parent;
+  }
+}
+
+static void sift_down(struct top_entry *heap, size_t n, size_t i) {
+  while (true) {
+    size_t smallest = i;
+    size_t left = 2 * i + 1;
+    size_t right = left + 1;
+
+    if (left < n && heap[left].number < heap[smallest].number)
+      smallest = left;
+    if (right < n && heap[right].number < heap[smallest].number)
+      smallest = right;
+    if (smallest == i)
+      return;
+
+    swap(&heap[i], &heap[smallest]);
+    i = smallest;
+  }
+}
+
+void top_insert(struct top *top, double number, const unsigned char *record,
+                size_t length) {
+  /* a full heap reuses the buffer of the root it replaces */
+  size_t i = top->n < top->k ? top->n++ : 0;
+  struct top_entry *entry = &top->heap[i];
+
+  if (length > entry->capacity) {
+    size_t capacity = max(length, 2 * entry->capacity);
+    unsigned char *buffer = realloc(entry->record, capacity);
+    if (unlikely(!buffer))
+      out_of_memory();
+    entry->record = buffer;
+    entry->capacity = capacity;
+  }
+
+  memcpy(entry->record, record, length);
+  entry->length = length;
+  entry->number = number;
+
+  if (i == 0 && top->n == top->k) {
+    sift_down(top->heap, top->n, 0);
+  } else {
+    sift_up(top->heap, i);
+  }
+}
+
+void top_print(struct top *top, FILE *out, const char *delimiter,
+               size_t delimiter_length) {
+  /* heapsort: moving the root to the end repeatedly leaves the entries in
+   * decreasing order */
+  for (size_t n = top->n; n > 1; --n) {
+    swap(&top->heap[0], &top->heap[n - 1]);
+    sift_down(top->heap, n - 1, 0);
+  }
+
+  for (size_t i = 0; i < top->n; ++i) {
+    fwrite(top->heap[i].record, 1, top->heap[i].length, out);
+    fwrite(delimiter, 1, delimiter_length, out);
+  }
+
+  top->n = 0;
+}
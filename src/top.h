@@ -0,0 +1,45 @@
+#ifndef _TOP_H
+#define _TOP_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+struct top_entry {
+  double number;
+  /* source of the record, in a buffer reused when the entry is replaced */
+  unsigned char *record;
+  size_t length;
+  size_t capacity;
+};
+
+/* The `k` records with the largest numbers seen so far, for --top. They are
+ * kept in a min-heap, so a record that does not make it is rejected by one
+ * comparison with the root. */
+struct top {
+  size_t k;
+  size_t n;
+  struct top_entry *heap;
+  /* number of the current record, if `has_number` */
+  double number;
+  bool has_number;
+};
+
+void top_init(struct top *top, size_t k);
+void top_destroy(struct top *top);
+
+/* Whether a record with `number` would enter the heap. */
+static inline bool top_admits(const struct top *top, double number) {
+  return top->n < top->k || number > top->heap[0].number;
+}
+
+/* Add a record that top_admits(), replacing the smallest if the heap is
+ * full. */
+void top_insert(struct top *top, double number, const unsigned char *record,
+                size_t length);
+
+/* Print the records, largest number first, each followed by the delimiter.
+ * The heap is emptied. */
+void top_print(struct top *top, FILE *out, const char *delimiter,
+               size_t delimiter_length);
+
+#endif
@@ -0,0 +1,80 @@
+#include "unique.h"
+#include "hash.h"
+#include "strpool.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct value_set_entry *alloc_table(size_t table_size) {
+  struct value_set_entry *table = calloc(table_size, sizeof(*table));
+  if (unlikely(!table))
+    out_of_memory();
+
+  return table;
+}
+
+void value_set_init(struct value_set *set, struct strpool *pool) {
+  set->pool = pool;
+  set->table_size = 1024;
+  set->table = alloc_table(set->table_size);
+  set->count = 0;
+}
+
+void value_set_destroy(struct value_set *set) {
+  free(set->table);
+}
+
+static void grow_table(struct value_set *set) {
+  size_t table_size = set->table_size * 2;
+  size_t mask = table_size - 1;
+  struct value_set_entry *table = alloc_table(table_size);
+
+  for (size_t i = 0; i < set->table_size; ++i) {
+    struct value_set_entry *entry = &set->table[i];
+    if (!entry->key)
+      continue;
+
+    size_t j = entry->hash & mask;
+    while (table[j].key)
+      j = (j + 1) & mask;
+    table[j] = *entry;
+  }
+
+  free(set->table);
+  set->table = table;
+  set->table_size = table_size;
+}
+
+bool value_set_insert(struct value_set *set, const unsigned char *key,
+                      size_t length) {
+  uint64_t hash = hash_bytes(key, length);
+  size_t mask = set->table_size - 1;
+
+  size_t i = hash & mask;
+  for (; set->table[i].key; i = (i + 1) & mask) {
+    struct value_set_entry *entry = &set->table[i];
+    if (entry->hash == hash && entry->length == length &&
+        memcmp(entry->key, key, length) == 0)
+      return false;
+  }
+
+  /* keys are never empty, so the copy is never the shared zero_buffer, and
+   * a NULL key still marks an empty slot */
+  unsigned char *copy = strpool_alloc(set->pool, length);
+  memcpy(copy, key, length);
+  strpool_commit(set->pool, length);
+
+  set->table[i] = (struct value_set_entry) {
+    .hash = hash,
+    .key = copy,
+    .length = length,
+  };
+
+  /* keep the load factor at most 1/2 */
+  if (2 * ++set->count > set->table_size)
+    grow_table(set);
+
+  return true;
+}
@@ -0,0 +1,32 @@
+#ifndef _UNIQUE_H
+#define _UNIQUE_H
+
+#include "strpool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct value_set_entry {
+  uint64_t hash;
+  /* NULL for an empty slot */
+  const unsigned char *key;
+  size_t length;
+};
+
+/* Set of byte strings for --unique. Slots are probed linearly and keys are
+ * copied into `pool`, which is only ever grown. */
+struct value_set {
+  struct strpool *pool;
+  struct value_set_entry *table;
+  size_t table_size;
+  size_t count;
+};
+
+void value_set_init(struct value_set *set, struct strpool *pool);
+void value_set_destroy(struct value_set *set);
+
+/* Add `key` to the set. Returns false if it was already there. */
+bool value_set_insert(struct value_set *set, const unsigned char *key,
+                      size_t length);
+
+#endif
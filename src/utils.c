@@ -0,0 +1,9 @@
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void out_of_memory(void) {
+  fputs("out of memory", stderr);
+  exit(1);
+}
@@ -14,5 +14,7 @@
 #define max(a, b) ((a) < (b) ? (b) : (a))
 #define min(a, b) ((a) > (b) ? (b) : (a))
 
+[[noreturn]] void out_of_memory(void);
+
 #endif
 
@@ -0,0 +1,397 @@
+#include "validate.h"
+#include "simd.h"
+#include "utils.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void validator_init(struct validator *validator, struct input *input,
+                    size_t max_depth) {
+  validator->input = input;
+  validator->stack = NULL;
+  validator->depth = 0;
+  validator->capacity = 0;
+  validator->max_depth = max_depth;
+  validator->records = 0;
+  validator->failed = false;
+  validator->error_offset = 0;
+  validator->error[0] = '\0';
+}
+
+void validator_destroy(struct validator *validator) {
+  free(validator->stack);
+}
+
+static bool fail(struct validator *validator, size_t offset, const char *fmt,
+                 ...) {
+  va_list ap;
+
+  validator->failed = true;
+  validator->error_offset = offset;
+  va_start(ap, fmt);
+  vsnprintf(validator->error, sizeof(validator->error), fmt, ap);
+  va_end(ap);
+  return false;
+}
+
+static bool fail_at(struct validator *validator, int ch, const char *what) {
+  size_t offset = input_tell(validator->input);
+  if (ch == EOF)
+    return fail(validator, offset, "unexpected EOF, expected %s", what);
+
+  return fail(validator, offset - 1, "unexpected byte 0x%02x, expected %s",
+              ch, what);
+}
+
+static inline bool is_digit(int ch) {
+  return ch >= '0' && ch <= '9';
+}
+
+static inline bool is_space(int ch) {
+  return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+static inline int hex_value(int ch) {
+  if (is_digit(ch))
+    return ch - '0';
+  if ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'f')
+    return (ch | 0x20) - 'a' + 10;
+  return -1;
+}
+
+/* the input never rewinds */
+static inline void release(struct input *input) {
+  input->token = input_tell(input);
+}
+
+static inline int skip_space(struct input *input) {
+  int ch;
+  while (is_space(ch = input_getc(input)))
+    ;
+  return ch;
+}
+
+static bool check_utf8(struct validator *validator, int lead) {
+  struct input *input = validator->input;
+  size_t start = input_tell(input) - 1;
+
+  /* number of continuation bytes and the range of the first one */
+  size_t count;
+  int low = 0x80;
+  int high = 0xbf;
+  if (lead >= 0xc2 && lead <= 0xdf) {
+    count = 1;
+  } else if (lead >= 0xe0 && lead <= 0xef) {
+    count = 2;
+    if (lead == 0xe0)
+      low = 0xa0;
+    else if (lead == 0xed)
+      high = 0x9f;
+  } else if (lead >= 0xf0 && lead <= 0xf4) {
+    count = 3;
+    if (lead == 0xf0)
+      low = 0x90;
+    else if (lead == 0xf4)
+      high = 0x8f;
+  } else {
+    return fail(validator, start, "invalid UTF-8 byte 0x%02x", lead);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    int ch = input_getc(input);
+    if (ch < low || ch > high)
+      return fail(validator, start, "invalid UTF-8 sequence");
+    low = 0x80;
+    high = 0xbf;
+  }
+
+  return true;
+}
+
+static int read_unicode_escape(struct input *input) {
+  int code = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    int digit = hex_value(input_getc(input));
+    if (digit < 0)
+      return -1;
+    code = code << 4 | digit;
+  }
+  return code;
+}
+
+static bool check_escape(struct validator *validator) {
+  struct input *input = validator->input;
+  size_t start = input_tell(input) - 1;
+
+  switch (input_getc(input)) {
+    case '"':
+    case '\\':
+    case '/':
+    case 'b':
+    case 'f':
+    case 'n':
+    case 'r':
+    case 't':
+      return true;
+    case 'u':
+      break;
+    default:
+      return fail(validator, start, "invalid escape");
+  }
+
+  int code = read_unicode_escape(input);
+  if (code < 0)
+    return fail(validator, start, "invalid \\u escape");
+  if (code >= 0xdc00 && code <= 0xdfff)
+    return fail(validator, start, "unpaired surrogate");
+  if (code < 0xd800 || code > 0xdbff)
+    return true;
+
+  if (input_getc(input) != '\\' || input_getc(input) != 'u')
+    return fail(validator, start, "unpaired surrogate");
+
+  code = read_unicode_escape(input);
+  if (code < 0xdc00 || code > 0xdfff)
+    return fail(validator, start, "unpaired surrogate");
+
+  return true;
+}
+
+static bool check_string(struct validator *validator) {
+  struct input *input = validator->input;
+  size_t start = input_tell(input) - 1;
+
+  for (;;) {
+    release(input);
+    if (unlikely(!input_fill(input)))
+      return fail(validator, start, "unterminated string");
+
+    input->curr = simd_find_string_stop(input->curr, input->end);
+    if (input->curr == input->end)
+      continue;
+
+    int ch = *input->curr++;
+    if (likely(ch == '"'))
+      return true;
+
+    if (ch == '\\') {
+      if (!check_escape(validator))
+        return false;
+    } else if (ch < 0x20) {
+      return fail(validator, input_tell(input) - 1,
+                  "control character in string");
+    } else if (!check_utf8(validator, ch)) {
+      return false;
+    }
+  }
+}
+
+/* so that "01" is not two values */
+static bool check_delimiter(struct validator *validator, size_t start,
+                            const char *what) {
+  struct input *input = validator->input;
+  if (!input_fill(input))
+    return true;
+
+  int ch = *input->curr;
+  if (is_space(ch) || ch == ',' || ch == ']' || ch == '}')
+    return true;
+
+  return fail(validator, start, "invalid %s", what);
+}
+
+static bool check_number(struct validator *validator, int ch) {
+  struct input *input = validator->input;
+  size_t start = input_tell(input) - 1;
+
+  if (ch == '-')
+    ch = input_getc(input);
+
+  if (ch == '0') {
+    ch = input_getc(input);
+  } else if (is_digit(ch)) {
+    while (is_digit(ch = input_getc(input)))
+      ;
+  } else {
+    return fail(validator, start, "invalid number");
+  }
+
+  if (ch == '.') {
+    if (!is_digit(ch = input_getc(input)))
+      return fail(validator, start, "invalid number");
+    while (is_digit(ch = input_getc(input)))
+      ;
+  }
+
+  if (ch == 'e' || ch == 'E') {
+    ch = input_getc(input);
+    if (ch == '+' || ch == '-')
+      ch = input_getc(input);
+    if (!is_digit(ch))
+      return fail(validator, start, "invalid number");
+    while (is_digit(ch = input_getc(input)))
+      ;
+  }
+
+  if (ch != EOF)
+    input_ungetc(input);
+
+  return check_delimiter(validator, start, "number");
+}
+
+static bool check_literal(struct validator *validator, const char *literal) {
+  struct input *input = validator->input;
+  size_t start = input_tell(input) - 1;
+  size_t length = strlen(literal) - 1;
+
+  if (!input_ensure(input, length) ||
+      memcmp(input->curr, literal + 1, length) != 0)
+    return fail(validator, start, "invalid literal");
+
+  input->curr += length;
+  return check_delimiter(validator, start, "literal");
+}
+
+static bool push(struct validator *validator, unsigned char kind) {
+  if (unlikely(validator->depth >= validator->max_depth))
+    return fail(validator, input_tell(validator->input) - 1,
+                "nesting depth exceeds %zu", validator->max_depth);
+
+  if (unlikely(validator->depth == validator->capacity)) {
+    size_t capacity = validator->capacity ? 2 * validator->capacity : 64;
+    unsigned char *stack = realloc(validator->stack, capacity);
+    if (unlikely(!stack))
+      out_of_memory();
+    validator->stack = stack;
+    validator->capacity = capacity;
+  }
+
+  validator->stack[validator->depth++] = kind;
+  return true;
+}
+
+enum expect {
+  EXPECT_VALUE,
+  EXPECT_KEY,
+  /* a comma or the end of the innermost container */
+  EXPECT_NEXT,
+};
+
+static bool check_value(struct validator *validator, int ch) {
+  struct input *input = validator->input;
+  enum expect expect = EXPECT_VALUE;
+
+  for (;;) {
+    release(input);
+    switch (expect) {
+      case EXPECT_VALUE: {
+        switch (ch) {
+          case '{':
+            if (!push(validator, '{'))
+              return false;
+            ch = skip_space(input);
+            if (ch == '}') {
+              --validator->depth;
+              expect = EXPECT_NEXT;
+            } else {
+              expect = EXPECT_KEY;
+              continue;
+            }
+            break;
+          case '[':
+            if (!push(validator, '['))
+              return false;
+            ch = skip_space(input);
+            if (ch == ']') {
+              --validator->depth;
+              expect = EXPECT_NEXT;
+            } else {
+              continue;
+            }
+            break;
+          case '"':
+            if (!check_string(validator))
+              return false;
+            expect = EXPECT_NEXT;
+            break;
+          case 't':
+            if (!check_literal(validator, "true"))
+              return false;
+            expect = EXPECT_NEXT;
+            break;
+          case 'f':
+            if (!check_literal(validator, "false"))
+              return false;
+            expect = EXPECT_NEXT;
+            break;
+          case 'n':
+            if (!check_literal(validator, "null"))
+              return false;
+            expect = EXPECT_NEXT;
+            break;
+          default:
+            if (ch != '-' && !is_digit(ch))
+              return fail_at(validator, ch, "a value");
+            if (!check_number(validator, ch))
+              return false;
+            expect = EXPECT_NEXT;
+            break;
+        }
+        break;
+      }
+      case EXPECT_KEY: {
+        if (ch != '"')
+          return fail_at(validator, ch, "a key");
+        if (!check_string(validator))
+          return false;
+        if ((ch = skip_space(input)) != ':')
+          return fail_at(validator, ch, "':'");
+        ch = skip_space(input);
+        expect = EXPECT_VALUE;
+        continue;
+      }
+      case EXPECT_NEXT:
+        break;
+    }
+
+    if (validator->depth == 0)
+      return true;
+
+    unsigned char kind = validator->stack[validator->depth - 1];
+    ch = skip_space(input);
+    if (ch == ',') {
+      ch = skip_space(input);
+      expect = kind == '{' ? EXPECT_KEY : EXPECT_VALUE;
+    } else if (ch == (kind == '{' ? '}' : ']')) {
+      --validator->depth;
+      expect = EXPECT_NEXT;
+    } else {
+      return fail_at(validator, ch, kind == '{' ? "',' or '}'" : "',' or ']'");
+    }
+  }
+}
+
+bool validate_text(struct validator *validator) {
+  int ch = skip_space(validator->input);
+  if (!check_value(validator, ch))
+    return false;
+
+  ch = skip_space(validator->input);
+  if (ch != EOF)
+    return fail_at(validator, ch, "EOF");
+
+  validator->records = 1;
+  return true;
+}
+
+bool validate_stream(struct validator *validator) {
+  int ch;
+  while ((ch = skip_space(validator->input)) != EOF) {
+    if (!check_value(validator, ch))
+      return false;
+    ++validator->records;
+  }
+  return true;
+}
@@ -0,0 +1,32 @@
+#ifndef _VALIDATE_H
+#define _VALIDATE_H
+
+#include "input.h"
+
+#include <stddef.h>
+
+/* strict RFC 8259 checker for --validate */
+struct validator {
+  struct input *input;
+  /* '[' or '{' for each open container */
+  unsigned char *stack;
+  size_t depth;
+  size_t capacity;
+  size_t max_depth;
+  /* number of complete top-level values */
+  size_t records;
+  /* whether an error was found, its stream offset and description */
+  bool failed;
+  size_t error_offset;
+  char error[64];
+};
+
+void validator_init(struct validator *validator, struct input *input,
+                    size_t max_depth);
+void validator_destroy(struct validator *validator);
+
+bool validate_text(struct validator *validator);
+
+bool validate_stream(struct validator *validator);
+
+#endif